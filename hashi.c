@@ -16,11 +16,26 @@
  * along with the hashi.  If not, see <https://www.gnu.org/licenses/>.
  */
 
-#include <stdio.h> /* NULL, printf, fprintf, stderr, getchar, EOF */
-#include <stdlib.h> /* exit */
-#include <string.h> /* memset */
+#define _POSIX_C_SOURCE 200809L /* getline, open_memstream */
+#define _DEFAULT_SOURCE /* syscall */
+
+#include <stdio.h> /* NULL, printf, fprintf, stderr, getchar, EOF, FILE */
+#include <stdlib.h> /* exit, strtoll */
+#include <string.h> /* memset, strcmp */
+#include <stddef.h> /* offsetof */
 #include <stdbool.h> /* bool, true, false */
-#include <limits.h> /* CHAR_MAX */
+#include <limits.h> /* CHAR_MAX, INT_MAX, LONG_MAX */
+#include <math.h> /* sqrt */
+#include <unistd.h> /* sysconf */
+#include <pthread.h> /* pthread_create, pthread_mutex_t, pthread_cond_t */
+#include <stdatomic.h> /* atomic_size_t, atomic_compare_exchange_weak */
+#include <sched.h> /* sched_yield */
+#include <time.h> /* nanosleep */
+#include <errno.h> /* errno */
+#ifdef __linux__
+#include <linux/perf_event.h> /* perf_event_attr, PERF_COUNT_HW_CPU_CYCLES */
+#include <sys/syscall.h> /* SYS_perf_event_open */
+#endif
 
 typedef enum enum_direction { UP = 0, LEFT, RIGHT, DOWN} direction;
 
@@ -41,6 +56,115 @@ typedef enum enum_direction { UP = 0, LEFT, RIGHT, DOWN} direction;
 #define MAX_CROSSELEMS 300
 #define MAX_VISITED_SIZE 10000
 
+/** Maximum of orderings of the bridges of an island in RIGHT and DOWN (9). */
+#define MAX_ORDERINGS \
+	((MAX_CONNECTION_BRIDGES + 1) * (MAX_CONNECTION_BRIDGES + 1))
+
+/** Default number of random descents used to estimate the search cost. */
+#define DEFAULT_PROBES 1000
+
+/** Initial value and multiplier of the FNV-1a hash function (64 bits). */
+#define HASH_OFFSET 14695981039346656037UL
+#define HASH_PRIME 1099511628211UL
+
+/** Default seed of the pseudo-random generator, so results are repeatable. */
+#define DEFAULT_SEED 1
+
+/** Default nodes of search multiplied by the Luby sequence between restarts.*/
+#define DEFAULT_RESTART_NODES 100
+
+/** Default maximum of changes of the local search, its initial temperature,
+ * the factor that reduces it after as many changes as connections and the
+ * minimum temperature, which starts it again from the initial one. */
+#define DEFAULT_LOCAL_STEPS 10000000
+#define LOCAL_TEMPERATURE 2.0
+#define LOCAL_COOLING 0.97
+#define LOCAL_MIN_TEMPERATURE 0.05
+
+/** Probability of changing a connection of an island with differences,
+ * and of moving the change to another connection of one of its islands. */
+#define LOCAL_FOCUS 0.9
+#define LOCAL_SHIFT 0.5
+
+/** Probability of fixing an island with differences with a path of changes
+ * to another one instead of changing only its connections. */
+#define LOCAL_PATH 0.05
+
+/** Probability of joining two groups of islands when there are no islands
+ * with differences. */
+#define LOCAL_JOIN 0.1
+
+/** Default rows kept by the streaming search of one solution, whose first
+ * half is printed when they are full. */
+#define DEFAULT_BAND_ROWS 256
+
+/** Times the band rows that the streaming search keeps at most while the
+ * partial solutions of the last row do not come from one state of a row
+ * before it, before it writes the first half choosing a state. */
+#define STREAM_DEFER_BANDS 4
+
+/** Random descents used to estimate the cost of each puzzle of a batch. */
+#define BATCH_PROBES 32
+
+/** Islands from which the cost of a puzzle of a batch is estimated with
+ * random descents. The smaller ones are ordered by their islands, because
+ * the descents would cost more than their whole search. */
+#define BATCH_PROBE_ISLANDS 48
+
+/** Steps of search that a puzzle runs before letting others use the thread. */
+#define SLICE_STEPS 20000
+
+/** Boards of the pipeline for each solver thread, which limit the memory. */
+#define PIPELINE_SLOTS_PER_SOLVER 4
+
+/** Size of the buffer of the standard output used by the pipeline. */
+#define PIPELINE_OUTPUT_BUFFER (1 << 20)
+
+/** Attempts to use a queue yielding the processor before starting to sleep,
+ * and nanoseconds to sleep after each of the next attempts. */
+#define QUEUE_SPINS 64
+#define QUEUE_SLEEP_NANOS 50000
+
+/** Solutions that the search can find before waiting for the writer thread. */
+#define ASYNC_RING_SOLUTIONS 4096
+
+/** Puzzles solved together by vector instructions (lanes of the vectors),
+ * maximum of islands and connections of those puzzles and maximum of
+ * deduction steps done with them. */
+#define LANES 16
+#define LANE_MAX_ISLANDS 32
+#define LANE_MAX_CONNECTIONS 64
+#define LANE_MAX_STEPS 64
+
+/** Tolerance of the comparisons of real numbers in the linear relaxation,
+ * minimum reduced cost to fix a connection and maximum of rows of the
+ * tableau of the relaxation. */
+#define LP_EPSILON 1e-9
+#define LP_FIX_MARGIN 1e-6
+#define LP_MAX_ROWS 512
+
+/** Islands whose search subtrees are all traced, spans of each frequent kind
+ * traced before sampling them, one of how many spans is traced after that,
+ * and maximum of spans traced in each thread. */
+#define TRACE_DEPTH 8
+#define TRACE_FULL_SPANS 256
+#define TRACE_SAMPLE_PERIOD 4096
+#define TRACE_MAX_EVENTS (1 << 20)
+
+/** Maximum of phases of the hardware counters entered one inside another. */
+#define COUNTER_DEPTH 8
+
+/** Buckets of each power of two of the latency histograms, and buckets
+ * of a histogram to keep any positive long long. */
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS) * HISTOGRAM_SUB_BUCKETS)
+
+/** Classes of puzzles by their islands in the latency histograms: less than
+ * the minimum, then each power of two, and the last one for all the bigger.*/
+#define LATENCY_CLASSES 8
+#define LATENCY_MIN_ISLANDS 16
+
 typedef struct st_hcrosselem hcrosselem;
 
 /** Element to compose a linked list of connections crossing a given connection.
@@ -54,22 +178,69 @@ struct st_hcrosselem {
  * which also includes a linked list with the other connections crossing it
  * because two crossing connections cannot have bridges at the same time,
  * and the address of to the number of pending bridges of each connected island
- * because a bridge cannot be built in an island with 0 pending bridges. */
+ * because a bridge cannot be built in an island with 0 pending bridges.
+ * When the changes are tracked, the connections with bridges added or deleted
+ * since the last printed solution are linked in a list (the dirty set)
+ * and the number of bridges of the last printed solution is saved. */
 typedef struct st_hconnection {
-	char bridges;
+	char bridges, printedbridges;
 	hcrosselem *firstcross;
 	char *ppendbridges1, *ppendbridges2;
+	bool dirty;
+	struct st_hconnection *nextdirty, **pfirstdirty;
 } hconnection;
 
 typedef struct st_hisland hisland;
 
+typedef struct st_hring hring;
+
+typedef struct st_hflow hflow;
+
+typedef struct st_himplications himplications;
+
+typedef struct st_hcuts hcuts;
+
+typedef struct st_hlp hlp;
+
+typedef struct st_hprofile hprofile;
+
+typedef struct st_htrace htrace;
+
+typedef struct st_hcounters hcounters;
+
+/** Counters of the work done by the search, printed with --stats. */
+typedef struct st_hstats {
+	long long nodes, flow_checks, flow_prunes, augmentations;
+	long long implication_checks, implication_prunes, implied;
+	long long skeletons, cut_checks, cut_prunes, forced_bridges;
+	long long lp_checks, lp_prunes, lp_warm, lp_pivots, lp_nanos;
+	long long lp_fixed, lp_fix_prunes;
+	long long restarts, local_steps, top_states, bottom_states;
+	long long warm_solutions;
+} hstats;
+
+/** Formats to print the solutions: the whole board, or only the connections
+ * with bridges changed since the previous solution (the first one is whole).*/
+typedef enum enum_output_format {
+	FORMAT_BOARD = 0, FORMAT_DELTA
+} output_format;
+
+/** Engines to find the solutions: the search of the bridges of each island,
+ * the search of the connections with bridges and then of their number of
+ * bridges, the local search of one solution, or the count of the solutions
+ * of two halves of the board joined at a row. */
+typedef enum enum_search_engine {
+	ENGINE_ISLANDS = 0, ENGINE_TOPOLOGY, ENGINE_LOCAL, ENGINE_MIDDLE
+} search_engine;
+
 /** An island has a constant expected number of bridges (1-8) to be built on it,
  * a calculated number of pending bridges that decreases when bridges are built,
  * four islands connected to it in each direction and the connections to them.
  * A connection saves the number of bridges between two islands in any moment.
  * An empty island and an empty connection are used when no connection exists.*/
 struct st_hisland {
-	char pendbridges, expectbridges, row, col;
+	char pendbridges, expectbridges;
+	int row, col;
 	hisland *islands[DIRECTIONS];
 	hconnection *connections[DIRECTIONS];
 };
@@ -85,9 +256,35 @@ typedef struct st_hboard {
 	bool *visitedmatrix;
 	hisland *islands, out_island_st, *out_island;
 	hconnection *connections, out_connection_st, *out_connection;
-	hcrosselem *crosselems;
+	hcrosselem *crosselems, *freecrosselems, *crossblocks;
+	bool grow_arrays;
+	FILE *out;
+	output_format format;
+	hconnection *firstdirty;
+	hring *ring;
+	bool count_only;
+	long long num_solutions;
+	hflow *flow;
+	himplications *implications;
+	hcuts *cuts;
+	hlp *lp;
+	hprofile *profile;
+	htrace *trace;
+	hcounters *counters;
+	hstats stats;
 } hboard;
 
+/** Arrays of the islands, connections, cross elements and visited positions
+ * of one board, allocated together when several boards are used at once. */
+typedef struct st_hstorage {
+	hisland islands[MAX_ISLANDS];
+	hconnection connections[MAX_CONNECTIONS];
+	hcrosselem crosselems[MAX_CROSSELEMS];
+	bool visitedmatrix[MAX_VISITED_SIZE];
+	bool startedpath[MAX_ISLANDS];
+	char solutionbridges[MAX_CONNECTIONS];
+} hstorage;
+
 void init_out_island(hisland *out_island) {
 	int i;
 	out_island->row = -1;
@@ -105,7 +302,11 @@ void init_out_island(hisland *out_island) {
 /** The connection to an island out of the board shows */
 void init_out_connection(hconnection *out_connection, hisland *out_island) {
 	out_connection->bridges = 0;
+	out_connection->printedbridges = 0;
 	out_connection->firstcross = NULL;
+	out_connection->dirty = false;
+	out_connection->nextdirty = NULL;
+	out_connection->pfirstdirty = NULL;
 	out_connection->ppendbridges1 = &(out_island->pendbridges);
 	out_connection->ppendbridges2 = &(out_island->pendbridges);
 }
@@ -126,13 +327,508 @@ void init_board(hboard *board, hisland *islands, int max_islands,
 	board->num_islands = 0;
 	board->num_connections = 0;
 	board->num_crosselems = 0;
+	board->freecrosselems = NULL;
+	board->crossblocks = NULL;
+	board->grow_arrays = false;
 	board->rows = 0;
 	board->cols = 0;
+	board->max_bridges = 0;
 	board->out_island = &(board->out_island_st);
 	init_out_island(board->out_island);
 	board->out_connection = &(board->out_connection_st);
 	init_out_connection(board->out_connection, board->out_island);
 	memset(board->visitedmatrix, 0, board->max_visited_size);
+	board->out = stdout;
+	board->format = FORMAT_BOARD;
+	board->firstdirty = NULL;
+	board->ring = NULL;
+	board->count_only = false;
+	board->num_solutions = 0;
+	board->flow = NULL;
+	board->implications = NULL;
+	board->cuts = NULL;
+	board->lp = NULL;
+	board->profile = NULL;
+	board->trace = NULL;
+	board->counters = NULL;
+	memset(&board->stats, 0, sizeof(hstats));
+}
+
+/** Initializes the board to use the arrays of the given storage. */
+void init_board_storage(hboard *board, hstorage *storage) {
+	init_board(board, storage->islands, MAX_ISLANDS,
+		storage->connections, MAX_CONNECTIONS,
+		storage->crosselems, MAX_CROSSELEMS,
+		storage->visitedmatrix, MAX_VISITED_SIZE);
+}
+
+/** Initializes the board with arrays allocated for the given maximums,
+ * for puzzles too big for a storage. Returns false if there is no memory.
+ * They can grow when the board is edited (see grow_board_arrays).
+ * The arrays must be freed with free_board_arrays. */
+bool init_board_arrays(hboard *board, int max_islands, int max_connections,
+		int max_crosselems, int max_visited_size) {
+	hisland *islands = malloc((max_islands + 1) * sizeof(hisland));
+	hconnection *connections = malloc((max_connections + 1)
+			* sizeof(hconnection));
+	hcrosselem *crosselems = malloc((max_crosselems + 1)
+			* sizeof(hcrosselem));
+	bool *visitedmatrix = malloc(max_visited_size + 1);
+	if (islands == NULL || connections == NULL || crosselems == NULL
+			|| visitedmatrix == NULL) {
+		fprintf(stderr, "Not enough memory for the board\n");
+		free(islands);
+		free(connections);
+		free(crosselems);
+		free(visitedmatrix);
+		return false;
+	}
+	init_board(board, islands, max_islands, connections, max_connections,
+			crosselems, max_crosselems, visitedmatrix,
+			max_visited_size);
+	board->grow_arrays = true;
+	return true;
+}
+
+/** Frees the arrays allocated by init_board_arrays. */
+void free_board_arrays(hboard *board) {
+	hcrosselem *block;
+	while ((block = board->crossblocks) != NULL) {
+		board->crossblocks = block->nextcross;
+		free(block);
+	}
+	free(board->islands);
+	free(board->connections);
+	free(board->crosselems);
+	free(board->visitedmatrix);
+}
+
+/** Grows the given array of elements of the given size to have space for
+ * the element with the given index or returns false if there is no memory. */
+bool grow_array(void **array, int num, int *max, size_t size) {
+	void *grown;
+	int newmax;
+	if (num < *max) {
+		return true;
+	}
+	for (newmax = *max ? *max : 256; newmax <= num; newmax *= 2);
+	if ((grown = realloc(*array, newmax * size)) == NULL) {
+		fprintf(stderr, "Not enough memory for %d elements\n", newmax);
+		return false;
+	}
+	*array = grown;
+	*max = newmax;
+	return true;
+}
+
+/** Returns the nanoseconds of the monotonic clock. */
+long long monotonic_nanos(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/** Kinds of spans too frequent to trace all of them: the subtrees of the
+ * islands deeper than TRACE_DEPTH, the creation of the connections of an
+ * island, the checks of connected solutions and the outputs of solutions. */
+typedef enum enum_trace_kind {
+	TRACE_DEEP_SEARCH = 0, TRACE_CONNECTIONS, TRACE_CONNECTED,
+	TRACE_OUTPUT, TRACE_KINDS
+} trace_kind;
+
+/** Span of a trace, with its start and duration in nanoseconds, the island
+ * whose subtree it measures (or -1) and the number of spans of its kind that
+ * it represents (more than 1 when they are sampled). */
+typedef struct st_htraceevent {
+	const char *name;
+	long long start, duration;
+	int island, sampled;
+} htraceevent;
+
+/** Spans of one thread, which only that thread writes without locks, with
+ * the spans of each frequent kind seen and the spans that did not fit. */
+struct st_htrace {
+	const char *name;
+	int tid;
+	htraceevent *events;
+	int num_events, max_events;
+	long long seen[TRACE_KINDS], dropped;
+	struct st_htrace *next;
+};
+
+/** Traces of all the threads, written as Chrome trace-event JSON at the end
+ * with the times from the creation of the tracer. */
+typedef struct st_htracer {
+	pthread_mutex_t mutex;
+	htrace *first;
+	int num_traces;
+	long long origin;
+} htracer;
+
+htracer *new_tracer(void) {
+	htracer *tracer;
+	if ((tracer = calloc(1, sizeof(htracer))) == NULL) {
+		fprintf(stderr, "Not enough memory for the trace\n");
+		return NULL;
+	}
+	pthread_mutex_init(&tracer->mutex, NULL);
+	tracer->origin = monotonic_nanos();
+	return tracer;
+}
+
+/** Adds the trace of a thread with the given name to the tracer. */
+htrace *add_trace(htracer *tracer, const char *name) {
+	htrace *trace;
+	if ((trace = calloc(1, sizeof(htrace))) == NULL) {
+		fprintf(stderr, "Not enough memory for the trace\n");
+		return NULL;
+	}
+	trace->name = name;
+	pthread_mutex_lock(&tracer->mutex);
+	trace->tid = ++tracer->num_traces;
+	trace->next = tracer->first;
+	tracer->first = trace;
+	pthread_mutex_unlock(&tracer->mutex);
+	return trace;
+}
+
+/** Returns 0 if the next span of the given kind must not be traced, or the
+ * number of spans that it represents: the first TRACE_FULL_SPANS spans of
+ * each kind are traced and then one of every TRACE_SAMPLE_PERIOD. */
+int trace_sample(htrace *trace, trace_kind kind) {
+	long long seen = trace->seen[kind]++;
+	if (seen < TRACE_FULL_SPANS) {
+		return 1;
+	}
+	return seen % TRACE_SAMPLE_PERIOD == 0 ? TRACE_SAMPLE_PERIOD : 0;
+}
+
+/** Saves a span of the trace from the given start until now, or counts it
+ * as dropped if the trace has already TRACE_MAX_EVENTS spans. */
+void trace_span(htrace *trace, const char *name, long long start, int island,
+		int sampled) {
+	htraceevent *event;
+	long long end = monotonic_nanos();
+	if (trace->num_events == trace->max_events) {
+		if (trace->max_events == TRACE_MAX_EVENTS
+				|| ! grow_array((void **) &trace->events,
+				trace->num_events, &trace->max_events,
+				sizeof(htraceevent))) {
+			trace->dropped++;
+			return;
+		}
+		if (trace->max_events > TRACE_MAX_EVENTS) {
+			trace->max_events = TRACE_MAX_EVENTS;
+		}
+	}
+	event = trace->events + trace->num_events++;
+	event->name = name;
+	event->start = start;
+	event->duration = end - start;
+	event->island = island;
+	event->sampled = sampled;
+}
+
+/** Writes the traces of all the threads to the given file as Chrome
+ * trace-event JSON (complete events in microseconds, with the island and
+ * the sampling in their arguments) and frees them with the tracer. */
+bool write_tracer(htracer *tracer, const char *path) {
+	FILE *file;
+	htrace *trace, *next;
+	htraceevent *event;
+	long long dropped = 0;
+	int i;
+	bool first = true;
+	if ((file = fopen(path, "w")) == NULL) {
+		perror(path);
+	} else {
+		fprintf(file, "{\"traceEvents\":[");
+	}
+	for (trace = tracer->first; trace != NULL; trace = next) {
+		next = trace->next;
+		if (file != NULL) {
+			fprintf(file, "%s\n{\"name\":\"thread_name\","
+					"\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+					"\"args\":{\"name\":\"%s\"}}",
+					first ? "" : ",", trace->tid,
+					trace->name);
+			first = false;
+		}
+		for (i = 0; file != NULL && i < trace->num_events; i++) {
+			event = trace->events + i;
+			fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\","
+					"\"pid\":1,\"tid\":%d,\"ts\":%.3f,"
+					"\"dur\":%.3f,\"args\":{", event->name,
+					trace->tid, (event->start
+					- tracer->origin) / 1e3,
+					event->duration / 1e3);
+			if (event->island > -1) {
+				fprintf(file, "\"island\":%d%s", event->island,
+						event->sampled > 1 ? "," : "");
+			}
+			if (event->sampled > 1) {
+				fprintf(file, "\"sampled\":%d",
+						event->sampled);
+			}
+			fprintf(file, "}}");
+		}
+		dropped += trace->dropped;
+		free(trace->events);
+		free(trace);
+	}
+	pthread_mutex_destroy(&tracer->mutex);
+	free(tracer);
+	if (file == NULL) {
+		return false;
+	}
+	fprintf(file, "\n],\"displayTimeUnit\":\"ns\"}\n");
+	if (dropped) {
+		fprintf(stderr, "Trace spans dropped: %lld\n", dropped);
+	}
+	return fclose(file) == 0;
+}
+
+/** Phases of the solving measured with --perf-counters: the reading of the
+ * puzzle, the connections added for each island, the search, the checks
+ * that the solutions are connected and their output. The counts go to the
+ * innermost phase entered, so each phase excludes the phases inside it. */
+typedef enum enum_counter_phase {
+	PHASE_READ = 0, PHASE_CONSTRUCTION, PHASE_SEARCH, PHASE_CONNECTED,
+	PHASE_OUTPUT, PHASES
+} counter_phase;
+
+/** Hardware events counted in each phase. */
+typedef enum enum_hw_counter {
+	COUNTER_CYCLES = 0, COUNTER_INSTRUCTIONS, COUNTER_L1D_MISSES,
+	COUNTER_LLC_MISSES, COUNTER_BRANCH_MISSES, COUNTERS
+} hw_counter;
+
+/** Hardware counters of the thread opened as one group, so they are read
+ * together, with the slot of each one in the values read from the group
+ * (-1 when it is not available), the values of the last reading, the
+ * stack of the phases entered and the counts and nanoseconds of each phase.*/
+struct st_hcounters {
+	int fds[COUNTERS], slots[COUNTERS], num_open, leader;
+	unsigned long long last[COUNTERS];
+	long long counts[PHASES][COUNTERS], nanos[PHASES], calls[PHASES];
+	long long last_nanos;
+	counter_phase stack[COUNTER_DEPTH];
+	int depth, overflow;
+	bool multiplexed;
+};
+
+#ifdef __linux__
+/** Opens a counter of the user space of this thread in the given group
+ * (-1 to start a group) and returns its file descriptor or -1. */
+int open_counter(unsigned int type, unsigned long long config, int group) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP
+			| PERF_FORMAT_TOTAL_TIME_ENABLED
+			| PERF_FORMAT_TOTAL_TIME_RUNNING;
+	return (int) syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+#endif
+
+/** Reads the counters of the group, returning false if none is open. */
+bool read_counters(hcounters *counters, unsigned long long *values) {
+#ifdef __linux__
+	unsigned long long data[3 + COUNTERS];
+	ssize_t size = (3 + counters->num_open) * sizeof(unsigned long long);
+	int i;
+	if (counters->num_open == 0
+			|| read(counters->leader, data, size) != size) {
+		return false;
+	}
+	if (data[2] < data[1]) {
+		counters->multiplexed = true;
+	}
+	for (i = 0; i < COUNTERS; i++) {
+		if (counters->slots[i] >= 0) {
+			values[i] = data[3 + counters->slots[i]];
+		}
+	}
+	return true;
+#else
+	(void) counters;
+	(void) values;
+	return false;
+#endif
+}
+
+/** Opens the hardware counters of this thread. The phases are measured
+ * anyway when the system does not allow any counter, only their times. */
+hcounters *new_counters(void) {
+	hcounters *counters;
+	int i;
+#ifdef __linux__
+	const unsigned int types[COUNTERS] = {
+		PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+		PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE
+	};
+	const unsigned long long configs[COUNTERS] = {
+		PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_CACHE_L1D
+				| (PERF_COUNT_HW_CACHE_OP_READ << 8)
+				| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+		PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+	};
+	int error = 0;
+#endif
+	if ((counters = calloc(1, sizeof(hcounters))) == NULL) {
+		fprintf(stderr, "Not enough memory for the counters\n");
+		return NULL;
+	}
+	counters->leader = -1;
+	for (i = 0; i < COUNTERS; i++) {
+		counters->slots[i] = -1;
+#ifdef __linux__
+		if ((counters->fds[i] = open_counter(types[i], configs[i],
+				counters->leader)) < 0) {
+			error = errno;
+			continue;
+		}
+		if (counters->leader < 0) {
+			counters->leader = counters->fds[i];
+		}
+		counters->slots[i] = counters->num_open++;
+#endif
+	}
+#ifdef __linux__
+	if (counters->num_open == 0) {
+		fprintf(stderr, "Performance counters unavailable: %s\n",
+				strerror(error));
+	}
+#else
+	fprintf(stderr, "Performance counters unavailable in this system\n");
+#endif
+	read_counters(counters, counters->last);
+	counters->last_nanos = monotonic_nanos();
+	return counters;
+}
+
+/** Adds the counts since the last reading to the innermost phase. */
+void account_phase(hcounters *counters) {
+	unsigned long long values[COUNTERS];
+	long long now = monotonic_nanos();
+	counter_phase phase;
+	bool counted = read_counters(counters, values);
+	int i;
+	if (counters->depth > 0) {
+		phase = counters->stack[counters->depth - 1];
+		counters->nanos[phase] += now - counters->last_nanos;
+		for (i = 0; counted && i < COUNTERS; i++) {
+			if (counters->slots[i] >= 0) {
+				counters->counts[phase][i] +=
+						values[i] - counters->last[i];
+			}
+		}
+	}
+	counters->last_nanos = now;
+	if (counted) {
+		memcpy(counters->last, values, sizeof(values));
+	}
+}
+
+/** Starts counting the given phase inside the current one. */
+void enter_phase(hcounters *counters, counter_phase phase) {
+	account_phase(counters);
+	counters->calls[phase]++;
+	if (counters->depth < COUNTER_DEPTH) {
+		counters->stack[counters->depth++] = phase;
+	} else {
+		counters->overflow++;
+	}
+}
+
+/** Stops counting the current phase and continues the outer one. */
+void leave_phase(hcounters *counters) {
+	account_phase(counters);
+	if (counters->overflow > 0) {
+		counters->overflow--;
+	} else if (counters->depth > 0) {
+		counters->depth--;
+	}
+}
+
+/** Prints the given counts per thousand instructions, or n/a. */
+void print_per_instructions(FILE *out, hcounters *counters, int phase,
+		hw_counter counter) {
+	long long *counts = counters->counts[phase];
+	if (counters->slots[counter] < 0
+			|| counters->slots[COUNTER_INSTRUCTIONS] < 0
+			|| counts[COUNTER_INSTRUCTIONS] == 0) {
+		fprintf(out, " %9s", "n/a");
+	} else {
+		fprintf(out, " %9.3f", 1000.0 * counts[counter]
+				/ counts[COUNTER_INSTRUCTIONS]);
+	}
+}
+
+/** Prints the counts of each phase with their instructions per cycle and
+ * their misses per thousand instructions (MPKI). */
+void print_counters(hcounters *counters, FILE *out) {
+	const char *names[PHASES] = {
+		"read", "construction", "search", "connected", "output"
+	};
+	long long *counts;
+	int phase;
+	fprintf(out, "%-12s %10s %9s %13s %13s %5s %9s %9s %9s\n", "Phase",
+			"Calls", "Millis", "Cycles", "Instructions", "IPC",
+			"L1D MPKI", "LLC MPKI", "Br MPKI");
+	for (phase = 0; phase < PHASES; phase++) {
+		counts = counters->counts[phase];
+		fprintf(out, "%-12s %10lld %9.3f", names[phase],
+				counters->calls[phase],
+				counters->nanos[phase] / 1e6);
+		if (counters->slots[COUNTER_CYCLES] < 0) {
+			fprintf(out, " %13s", "n/a");
+		} else {
+			fprintf(out, " %13lld", counts[COUNTER_CYCLES]);
+		}
+		if (counters->slots[COUNTER_INSTRUCTIONS] < 0) {
+			fprintf(out, " %13s", "n/a");
+		} else {
+			fprintf(out, " %13lld",
+					counts[COUNTER_INSTRUCTIONS]);
+		}
+		if (counters->slots[COUNTER_CYCLES] < 0
+				|| counters->slots[COUNTER_INSTRUCTIONS] < 0
+				|| counts[COUNTER_CYCLES] == 0) {
+			fprintf(out, " %5s", "n/a");
+		} else {
+			fprintf(out, " %5.2f", (double)
+					counts[COUNTER_INSTRUCTIONS]
+					/ counts[COUNTER_CYCLES]);
+		}
+		print_per_instructions(out, counters, phase,
+				COUNTER_L1D_MISSES);
+		print_per_instructions(out, counters, phase,
+				COUNTER_LLC_MISSES);
+		print_per_instructions(out, counters, phase,
+				COUNTER_BRANCH_MISSES);
+		fprintf(out, "\n");
+	}
+	if (counters->multiplexed) {
+		fprintf(out, "The counters were multiplexed, "
+				"so their counts are partial\n");
+	}
+}
+
+/** Closes the counters and frees them. */
+void free_counters(hcounters *counters) {
+	int i;
+	for (i = 0; i < COUNTERS; i++) {
+		if (counters->slots[i] >= 0) {
+			close(counters->fds[i]);
+		}
+	}
+	free(counters);
 }
 
 /** Finds an island from the island with the given index to connect both. */
@@ -220,7 +916,39 @@ hconnection *next_connection(hboard *board) {
 	return board->connections + board->num_connections++;
 }
 
+/** Adds to the free cross elements a new block as big as the array of the
+ * board, whose first element links it to the previous blocks. */
+bool grow_crosselems(hboard *board) {
+	int size = board->max_crosselems > 256 ? board->max_crosselems : 256;
+	hcrosselem *block = malloc((size + 1) * sizeof(hcrosselem));
+	int i;
+	if (block == NULL) {
+		fprintf(stderr, "Not enough memory for %d cross elements\n",
+				size);
+		return false;
+	}
+	block->nextcross = board->crossblocks;
+	board->crossblocks = block;
+	for (i = size; i > 0; i--) {
+		block[i].nextcross = board->freecrosselems;
+		board->freecrosselems = block + i;
+	}
+	return true;
+}
+
+/** Returns a cross element freed by an edit of the board or the next one,
+ * adding a block of them if the arrays of the board can grow. */
 hcrosselem *next_crosselem(hboard *board) {
+	hcrosselem *crosselem = board->freecrosselems;
+	if (crosselem == NULL && board->grow_arrays
+			&& board->num_crosselems >= board->max_crosselems
+			&& ! grow_crosselems(board)) {
+		return NULL;
+	}
+	if ((crosselem = board->freecrosselems) != NULL) {
+		board->freecrosselems = crosselem->nextcross;
+		return crosselem;
+	}
 	if (board->num_crosselems >= board->max_crosselems) {
 		fprintf(stderr, "Maximum of cross elements reached: %d\n",
 				board->num_crosselems);
@@ -236,73 +964,107 @@ void insert_crosselem(hconnection *connection, hcrosselem *crosselem) {
 	connection->firstcross = crosselem;
 }
 
+/** Inserts in each of the given crossing connections a cross element with
+ * the other one. */
+bool add_cross_pair(hboard *board, hconnection *conn_vert,
+		hconnection *conn_horz) {
+	hcrosselem *cross;
+	if ((cross = next_crosselem(board)) == NULL) {
+		return false;
+	}
+	cross->pbridges = &(conn_vert->bridges);
+	insert_crosselem(conn_horz, cross);
+	if ((cross = next_crosselem(board)) == NULL) {
+		return false;
+	}
+	cross->pbridges = &(conn_horz->bridges);
+	insert_crosselem(conn_vert, cross);
+	return true;
+}
+
 /** Finds the connections crossing the connection between the given islands. */
 bool fill_crosses(hboard *board, hisland *up, hisland *down) {
 	hisland *island, *right;
-	hcrosselem *cross;
-	hconnection *conn_vert, *conn_horz;
 	int col = up->col;
-	conn_vert = up->connections[DOWN];
 	for (island = up + 1; island != down; island++) {
 		if (island->row > up->row && island->row < down->row
 				&& island->col < col) {
 			right = island->islands[RIGHT];
-			if (right != board->out_island && right->col > col) {
-				conn_horz = island->connections[RIGHT];
-				if ((cross = next_crosselem(board)) == NULL) {
-					return false;
-				}
-				cross->pbridges = &(conn_vert->bridges);
-				insert_crosselem(conn_horz, cross);
-				if ((cross = next_crosselem(board)) == NULL) {
-					return false;
-				}
-				cross->pbridges = &(conn_horz->bridges);
-				insert_crosselem(conn_vert, cross);
+			if (right != board->out_island && right->col > col
+					&& ! add_cross_pair(board,
+					up->connections[DOWN],
+					island->connections[RIGHT])) {
+				return false;
 			}
 		}
 	}
 	return true;
 }
 
+/** Finds the connections crossing the connection between the given islands
+ * of the same row, which go down from islands of the previous rows. */
+bool fill_row_crosses(hboard *board, hisland *left, hisland *right) {
+	hisland *island, *down;
+	int i;
+	for (i = (int) (left - board->islands) - 1; i > -1; i--) {
+		island = board->islands + i;
+		down = island->islands[DOWN];
+		if (island->row < left->row && island->col > left->col
+				&& island->col < right->col
+				&& down != board->out_island
+				&& down->row > left->row
+				&& ! add_cross_pair(board,
+				island->connections[DOWN],
+				left->connections[RIGHT])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Creates the connection between the given island and the next island in
+ * the given direction (RIGHT or DOWN), linking both islands to it. */
+hconnection *new_connection(hboard *board, hisland *island, hisland *next,
+		direction dir) {
+	hconnection *connection;
+	if ((connection = next_connection(board)) == NULL) {
+		return NULL;
+	}
+	connection->bridges = 0;
+	connection->printedbridges = 0;
+	connection->firstcross = NULL;
+	connection->dirty = false;
+	connection->nextdirty = NULL;
+	connection->pfirstdirty = NULL;
+	connection->ppendbridges1 = &(island->pendbridges);
+	connection->ppendbridges2 = &(next->pendbridges);
+	island->connections[dir] = connection;
+	island->islands[dir] = next;
+	next->connections[DIRECTIONS - 1 - dir] = connection;
+	next->islands[DIRECTIONS - 1 - dir] = island;
+	return connection;
+}
+
 /** Creates the connections of the last added island. */
 bool fill_connections(hboard *board) {
 	hisland *island, *left, *up;
-	hconnection *connection;
 	int i;
 	int index = board->num_islands - 1;
 	island = board->islands + index;
-	island->islands[RIGHT] = board->out_island;
-	island->islands[DOWN] = board->out_island;
-	island->islands[LEFT] = left = find_from_island(board, index, LEFT);
-	island->islands[UP] = up = find_from_island(board, index, UP);
-	connection = board->out_connection;
 	for (i = 0; i < DIRECTIONS; i++) {
-		island->connections[i] = connection;
+		island->islands[i] = board->out_island;
+		island->connections[i] = board->out_connection;
 	}
-	if (left != board->out_island) {
-		if ((connection = next_connection(board)) == NULL) {
-			return false;
-		}
-		connection->bridges = 0;
-		connection->firstcross = NULL;
-		connection->ppendbridges1 = &(left->pendbridges);
-		connection->ppendbridges2 = &(island->pendbridges);
-		island->connections[LEFT] = connection;
-		left->connections[RIGHT] = connection;
-		left->islands[RIGHT] = island;
+	left = find_from_island(board, index, LEFT);
+	up = find_from_island(board, index, UP);
+	if (left != board->out_island
+			&& new_connection(board, left, island, RIGHT) == NULL) {
+		return false;
 	}
 	if (up != board->out_island) {
-		if ((connection = next_connection(board)) == NULL) {
+		if (new_connection(board, up, island, DOWN) == NULL) {
 			return false;
 		}
-		connection->bridges = 0;
-		connection->firstcross = NULL;
-		connection->ppendbridges1 = &(up->pendbridges);
-		connection->ppendbridges2 = &(island->pendbridges);
-		island->connections[UP] = connection;
-		up->connections[DOWN] = connection;
-		up->islands[DOWN] = island;
 		if (! fill_crosses(board, up, island)) {
 			return false;
 		}
@@ -313,16 +1075,15 @@ bool fill_connections(hboard *board) {
 /** Adds a new island that must have a row/colum bigger than previous island. */
 bool add_island(hboard *board, int row, int col, int expectbridges) {
 	hisland *island;
+	long long start = 0;
+	int sampled = 0;
 	if (row < 0 || col < 0) {
 		fprintf(stderr, "Negative position: %d,%d\n", row, col);
 		return false;
 	}
-	if (row >= CHAR_MAX) {
-		fprintf(stderr, "Maximum of rows reached: %d\n", row);
-		return false;
-	}
-	if (col >= CHAR_MAX) {
-		fprintf(stderr, "Maximum of columns reached: %d\n", col);
+	if (row == INT_MAX || col == INT_MAX) {
+		fprintf(stderr, "Maximum of rows or columns reached: %d,%d\n",
+				row, col);
 		return false;
 	}
 	if (board->num_islands > 0) {
@@ -349,9 +1110,23 @@ bool add_island(hboard *board, int row, int col, int expectbridges) {
 	if (board->cols <= col) {
 		board->cols = col + 1;
 	}
+	if (board->trace != NULL && (sampled = trace_sample(board->trace,
+			TRACE_CONNECTIONS))) {
+		start = monotonic_nanos();
+	}
+	if (board->counters != NULL) {
+		enter_phase(board->counters, PHASE_CONSTRUCTION);
+	}
 	if (! fill_connections(board)) {
 		return false;
 	}
+	if (board->counters != NULL) {
+		leave_phase(board->counters);
+	}
+	if (sampled) {
+		trace_span(board->trace, "connections", start,
+				board->num_islands - 1, sampled);
+	}
 	board->max_bridges += expectbridges;
 	return true;
 }
@@ -367,10 +1142,10 @@ void print_empty_position(hboard *board, int i, int j) {
 			if (conn->bridges == 0) {
 				emptyleft = true;
 			} else if (conn->bridges == 1) {
-				printf("---");
+				fprintf(board->out, "---");
 				printed = true;
 			} else if (conn->bridges == 2) {
-				printf("===");
+				fprintf(board->out, "===");
 				printed = true;
 			}
 		}
@@ -382,23 +1157,23 @@ void print_empty_position(hboard *board, int i, int j) {
 			if (conn->bridges == 0) {
 				emptyup = true;
 			} else if (conn->bridges == 1) {
-				printf(" ! ");
+				fprintf(board->out, " ! ");
 				printed = true;
 			} else if (conn->bridges == 2) {
-				printf(" !!");
+				fprintf(board->out, " !!");
 				printed = true;
 			}
 		}
 	}
 	if (! printed) {
 		if (emptyleft && emptyup) {
-			printf(" + ");
+			fprintf(board->out, " + ");
 		} else if (emptyleft) {
-			printf(" - ");
+			fprintf(board->out, " - ");
 		} else if (emptyup) {
-			printf(" ' ");
+			fprintf(board->out, " ' ");
 		} else {
-			printf(" . ");
+			fprintf(board->out, " . ");
 		}
 	}
 }
@@ -412,16 +1187,16 @@ void print_space_right(hboard *board, int i, int j) {
 		conn = left->connections[RIGHT];
 		if (conn != board->out_connection) {
 			if (conn->bridges == 1) {
-				printf("--");
+				fprintf(board->out, "--");
 				printed = true;
 			} else if (conn->bridges == 2) {
-				printf("==");
+				fprintf(board->out, "==");
 				printed = true;
 			}
 		}
 	}
 	if (! printed) {
-		printf("  ");
+		fprintf(board->out, "  ");
 	}
 }
 
@@ -434,16 +1209,16 @@ void print_space_down(hboard *board, int i, int j) {
 		conn = up->connections[DOWN];
 		if (conn != board->out_connection) {
 			if (conn->bridges == 1) {
-				printf(" ! ");
+				fprintf(board->out, " ! ");
 				printed = true;
 			} else if (conn->bridges == 2) {
-				printf(" !!");
+				fprintf(board->out, " !!");
 				printed = true;
 			}
 		}
 	}
 	if (! printed) {
-		printf("   ");
+		fprintf(board->out, "   ");
 	}
 }
 
@@ -455,45 +1230,175 @@ void print_board(hboard *board) {
 			if (index < board->num_islands) {
 				island = board->islands + index;
 				if (island->row == i && island->col == j) {
-					printf("(%d)",island->expectbridges);
+					fprintf(board->out, "(%d)",
+							island->expectbridges);
 					index++;
 				} else {
 					print_empty_position(board, i, j);
 				}
 			} else {
-				printf(" . ");
+				fprintf(board->out, " . ");
 			}
 			print_space_right(board, i, j + 1);
 		}
-		printf("\n");
+		fprintf(board->out, "\n");
 		for (j = 0; j < board->cols; j++) {
 			print_space_down(board, i + 1, j);
-			printf("  ");
+			fprintf(board->out, "  ");
 		}
-		printf("\n");
+		fprintf(board->out, "\n");
 	}	
-	printf("\n");
+	fprintf(board->out, "\n");
 }
 
-/** Reads the islands from the standard input and adds them to the board.
+/** Adds an island or moves the current position depending on the character.
  * Supported format: 02/000/1001/35/0202 (or '.' and '\n' for '0' and '/'). */
+bool read_island_char(hboard *board, int c, int *row, int *col) {
+	if (c == '/' || c == '\n') {
+		(*row)++;
+		*col = 0;
+	} else if (c == '.' || c == '0') {
+		(*col)++;
+	} else if (c > '0' && c <= '9') {
+		if (! add_island(board, *row, *col, c - '0')) {
+			return false;
+		}
+		(*col)++;
+	}
+	return true;
+}
+
+/** Reads the islands from the standard input and adds them to the board. */
 bool read_islands(hboard *board) {
 	int c, row, col;
 	row = col = 0;
 	while ((c = getchar()) != EOF) {
-		if (c == '/' || c == '\n') {
-			row++;
-			col = 0;
-		} else if (c == '.' || c == '0') {
-			col++;
-		} else if (c > '0' && c <= '9') {
-			if (! add_island(board, row, col, c - '0')) {
+		if (! read_island_char(board, c, &row, &col)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Reads the islands of a puzzle written in one line of text. */
+bool read_islands_line(hboard *board, const char *line) {
+	int row, col;
+	row = col = 0;
+	for (; *line != '\0' && *line != '\n'; line++) {
+		if (! read_island_char(board, *line, &row, &col)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Reads the islands of a puzzle written in a text of any number of lines. */
+bool read_islands_text(hboard *board, const char *text) {
+	int row, col;
+	row = col = 0;
+	for (; *text != '\0'; text++) {
+		if (! read_island_char(board, *text, &row, &col)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Island of the sparse input format: its position and expected bridges. */
+typedef struct st_hsparse {
+	int row, col, bridges;
+} hsparse;
+
+/** Compares the positions of two islands of the sparse format by rows. */
+int compare_sparse(const void *a, const void *b) {
+	const hsparse *first = a, *second = b;
+	if (first->row != second->row) {
+		return first->row < second->row ? -1 : 1;
+	}
+	return first->col < second->col ? -1 : first->col > second->col;
+}
+
+/** Returns the cross elements that fill_crosses needs for the given islands
+ * sorted by rows: two for each connection crossing the DOWN connection that
+ * ends in each island. */
+long long count_sparse_crosselems(hsparse *islands, int num) {
+	long long total = 0;
+	int i, j, up, col;
+	for (i = 0; i < num; i++) {
+		col = islands[i].col;
+		for (up = i - 1; up > -1 && islands[up].col != col; up--);
+		for (j = up + 1; up > -1 && j < i; j++) {
+			if (islands[j].row > islands[up].row
+					&& islands[j].row < islands[i].row
+					&& islands[j].col < col
+					&& islands[j + 1].row == islands[j].row
+					&& islands[j + 1].col > col) {
+				total += 2;
+			}
+		}
+	}
+	return total;
+}
+
+/** Reads the islands of the sparse format from the standard input, one
+ * "row col bridges" triple each in any order, and adds them sorted by rows
+ * to the board, whose arrays are allocated for them (keeping the options of
+ * the board). The arrays must be freed with free_board_arrays. */
+bool read_sparse_islands(hboard *board) {
+	hsparse *islands = NULL, island, *grown;
+	int num = 0, max = 0, i, read;
+	long long crosselems;
+	bool count_only = board->count_only, ok = true;
+	htrace *trace = board->trace;
+	hcounters *counters = board->counters;
+	while ((read = scanf("%d %d %d", &island.row, &island.col,
+			&island.bridges)) == 3) {
+		if (num == max) {
+			max = max ? max * 2 : 256;
+			if ((grown = realloc(islands, max * sizeof(hsparse)))
+					== NULL) {
+				fprintf(stderr, "Not enough memory for %d "
+						"islands\n", max);
+				free(islands);
 				return false;
 			}
-			col++;
+			islands = grown;
 		}
+		islands[num++] = island;
+	}
+	if (read != EOF) {
+		fprintf(stderr, "Bad sparse island: %d\n", num + 1);
+		free(islands);
+		return false;
+	}
+	qsort(islands, num, sizeof(hsparse), compare_sparse);
+	crosselems = count_sparse_crosselems(islands, num);
+	if (crosselems > INT_MAX / 2) {
+		fprintf(stderr, "Maximum of cross elements reached: %lld\n",
+				crosselems);
+		ok = false;
+	} else if (! init_board_arrays(board, num, 2 * num, (int) crosselems,
+			num)) {
+		ok = false;
+	}
+	board->count_only = count_only;
+	board->trace = trace;
+	board->counters = counters;
+	for (i = 0; ok && i < num; i++) {
+		ok = add_island(board, islands[i].row, islands[i].col,
+				islands[i].bridges);
+	}
+	free(islands);
+	return ok;
+}
+
+/** Adds the connection to the dirty set if the changes are being tracked. */
+void mark_dirty(hconnection *connection) {
+	if (connection->pfirstdirty != NULL && ! connection->dirty) {
+		connection->dirty = true;
+		connection->nextdirty = *(connection->pfirstdirty);
+		*(connection->pfirstdirty) = connection;
 	}
-	return true;
 }
 
 /** Adds a bridge to the given connection or returns false if cannot be done. */
@@ -512,6 +1417,7 @@ bool add_bridge(hconnection *connection) {
 		connection->bridges++;
 		(*(connection->ppendbridges1))--;
 		(*(connection->ppendbridges2))--;
+		mark_dirty(connection);
 		return true;
 	}
 	return false;
@@ -523,6 +1429,7 @@ bool del_bridge(hconnection *connection) {
 		connection->bridges--;
 		(*(connection->ppendbridges1))++;
 		(*(connection->ppendbridges2))++;
+		mark_dirty(connection);
 		return true;
 	}
 	return false;
@@ -568,12 +1475,13 @@ bool reorder_bridges(hisland *island) {
 
 /** Visits recursively the given island and all its connected islands,
  * if not visited already, returning the total number of visited islands,
- * setting to true the positions of the matrix of the visited islands and
+ * setting to true the positions of the visited islands in the matrix (by
+ * their index, so it does not depend on the size of the board) and
  * updating the limit of positions true in the matrix of visited islands. */
 int visit_islands(hboard *board, hisland *island) {
 	int total = 0, pos, i;
 	if (island != board->out_island) {
-		pos = island->row * board->cols + island->col;
+		pos = (int) (island - board->islands);
 		if (! board->visitedmatrix[pos]) {
 			board->visitedmatrix[pos] = true;
 			total++;
@@ -594,13 +1502,27 @@ int visit_islands(hboard *board, hisland *island) {
 /** Returns true if the given solution forms only one connected group. */
 bool check_connected_solution(hboard *board) {
 #ifdef CHECK_CONNECTED_SOLUTION
-	int total;
+	int total, sampled = 0;
+	long long start = 0;
+	if (board->trace != NULL && (sampled = trace_sample(board->trace,
+			TRACE_CONNECTED))) {
+		start = monotonic_nanos();
+	}
+	if (board->counters != NULL) {
+		enter_phase(board->counters, PHASE_CONNECTED);
+	}
 	board->visitedlimit = 0;
 	total = visit_islands(board, board->islands);
 	if (board->visitedlimit) {
 		memset(board->visitedmatrix, 0, board->visitedlimit);
 		board->visitedlimit = 0;
 	}
+	if (board->counters != NULL) {
+		leave_phase(board->counters);
+	}
+	if (sampled) {
+		trace_span(board->trace, "connected", start, -1, sampled);
+	}
 	if (total != board->num_islands) {
 		return false;
 	}
@@ -608,48 +1530,6916 @@ bool check_connected_solution(hboard *board) {
 	return true;
 }
 
-/** Finds all solutions by brute force without mandatory bridges. */
-void find_solutions_from_island(hboard* board, int idx) {
-	if (idx >= board->num_islands) {
-		if (check_connected_solution(board)) {
-			print_board(board);
-		}
-		return;
+/** Waits a little after failing to use a queue: first yielding the processor
+ * and then sleeping, so a thread waiting for a long time does not spin. */
+void wait_queue(int *attempts) {
+	struct timespec pause = { 0, QUEUE_SLEEP_NANOS };
+	if (++(*attempts) < QUEUE_SPINS) {
+		sched_yield();
+	} else {
+		nanosleep(&pause, NULL);
 	}
-	if (fill_bridges(board->islands + idx)) {
-		find_solutions_from_island(board, idx + 1);
-		while (reorder_bridges(board->islands + idx)) {
+}
+
+/** Ring of solutions written by the search and read by a writer thread,
+ * each one saved as the bridges of each connection. Only the search moves
+ * the head and only the writer moves the tail, so no locks are needed. */
+struct st_hring {
+	char *solutions;
+	int size, num_connections;
+	atomic_long head, tail;
+	atomic_bool closed;
+};
+
+/** Copies the bridges of the board to the ring, waiting while it is full. */
+void push_solution(hring *ring, hboard *board) {
+	long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	char *solution = ring->solutions
+			+ (head % ring->size) * ring->num_connections;
+	int attempts = 0, i;
+	while (head - atomic_load_explicit(&ring->tail, memory_order_acquire)
+			>= ring->size) {
+		wait_queue(&attempts);
+	}
+	for (i = 0; i < ring->num_connections; i++) {
+		solution[i] = board->connections[i].bridges;
+	}
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/** Sets the format to print the solutions of the board, which must have all
+ * its islands, starting to track the changes of bridges if it is needed. */
+void set_output_format(hboard *board, output_format format) {
+	int i;
+	board->format = format;
+	for (i = 0; i < board->num_connections; i++) {
+		board->connections[i].pfirstdirty = format == FORMAT_DELTA
+				? &(board->firstdirty) : NULL;
+	}
+}
+
+/** Returns the island whose number of pending bridges is at the address. */
+hisland *pending_island(char *ppendbridges) {
+	return (hisland *) (ppendbridges - offsetof(hisland, pendbridges));
+}
+
+/** Prints the connections of the dirty set whose bridges have changed since
+ * the previous solution, ending with an empty line, and empties the set. */
+void print_delta(hboard *board) {
+	hconnection *conn;
+	hisland *island1, *island2;
+	for (conn = board->firstdirty; conn != NULL; conn = conn->nextdirty) {
+		conn->dirty = false;
+		if (conn->bridges != conn->printedbridges) {
+			island1 = pending_island(conn->ppendbridges1);
+			island2 = pending_island(conn->ppendbridges2);
+			fprintf(board->out, "%d,%d - %d,%d: %d\n",
+					island1->row, island1->col,
+					island2->row, island2->col,
+					conn->bridges);
+			conn->printedbridges = conn->bridges;
+		}
+	}
+	board->firstdirty = NULL;
+	fprintf(board->out, "\n");
+}
+
+/** Counts the solution in the board and prints it unless only counting,
+ * or passes it to the writer thread if the board has a ring of solutions. */
+void emit_solution(hboard *board) {
+	hconnection *conn;
+	long long start = 0;
+	int i, sampled = 0;
+	board->num_solutions++;
+	if (board->count_only) {
+		return;
+	}
+	if (board->ring != NULL) {
+		push_solution(board->ring, board);
+		return;
+	}
+	if (board->trace != NULL && (sampled = trace_sample(board->trace,
+			TRACE_OUTPUT))) {
+		start = monotonic_nanos();
+	}
+	if (board->counters != NULL) {
+		enter_phase(board->counters, PHASE_OUTPUT);
+	}
+	if (board->format == FORMAT_DELTA && board->num_solutions > 1) {
+		print_delta(board);
+	} else {
+		print_board(board);
+	}
+	if (board->counters != NULL) {
+		leave_phase(board->counters);
+	}
+	if (sampled) {
+		trace_span(board->trace, "output", start, -1, sampled);
+	}
+	if (board->format == FORMAT_DELTA && board->num_solutions == 1) {
+		for (conn = board->firstdirty; conn != NULL;
+				conn = conn->nextdirty) {
+			conn->dirty = false;
+		}
+		board->firstdirty = NULL;
+		for (i = 0; i < board->num_connections; i++) {
+			conn = board->connections + i;
+			conn->printedbridges = conn->bridges;
+		}
+	}
+}
+
+/** Flow network to check if the pending bridges of all the islands can be
+ * built in the connections not decided yet, ignoring that the connections
+ * cannot cross and that the solution must be connected. Each island has
+ * a node that takes up to its pending bridges from the source and sends
+ * them to the other islands through the connections (each one with its
+ * capacity in both directions) and a node that receives up to its pending
+ * bridges and sends them to the sink. The check fails when the maximum flow
+ * does not fill all the pending bridges, because half of the flow in both
+ * directions of the connections would be a valid (fractional) solution.
+ * The flow is kept between checks, so only its changes must be augmented. */
+struct st_hflow {
+	int period, num_islands, num_connections;
+	char *cap, *forward, *backward;
+	int *sourceflow, *sinkflow;
+	int *queue, *prevnode;
+	char **prevarc;
+	bool *visited;
+};
+
+/** Returns the index of the given island in the array of islands. */
+int island_index(hboard *board, hisland *island) {
+	return (int) (island - board->islands);
+}
+
+/** Returns the index of the given connection in the array of connections. */
+int connection_index(hboard *board, hconnection *connection) {
+	return (int) (connection - board->connections);
+}
+
+/** Returns the index of the island at the given end of the connection. */
+int connection_end(hboard *board, hconnection *connection, bool first) {
+	return island_index(board, pending_island(first
+			? connection->ppendbridges1
+			: connection->ppendbridges2));
+}
+
+/** Returns the flow from the island to the other island of the connection
+ * in the given direction: the connections of the RIGHT and DOWN directions
+ * start from the island (forward) and the others end in it (backward). */
+char *arc_flow(hflow *flow, int conn, int dir, bool incoming) {
+	bool forward = dir == RIGHT || dir == DOWN;
+	return forward != incoming ? flow->forward + conn
+			: flow->backward + conn;
+}
+
+/** Frees the flow network and its arrays. */
+void free_flow(hflow *flow) {
+	free(flow->cap);
+	free(flow->forward);
+	free(flow->backward);
+	free(flow->sourceflow);
+	free(flow->sinkflow);
+	free(flow->queue);
+	free(flow->prevnode);
+	free(flow->prevarc);
+	free(flow->visited);
+	free(flow);
+}
+
+/** Creates the flow network to check the board every given number of islands.
+ * The board must have all its islands. */
+hflow *new_flow(hboard *board, int period) {
+	hflow *flow;
+	int n = board->num_islands, m = board->num_connections;
+	if ((flow = calloc(1, sizeof(hflow))) == NULL) {
+		return NULL;
+	}
+	flow->period = period;
+	flow->num_islands = n;
+	flow->num_connections = m;
+	flow->cap = calloc(m + 1, 1);
+	flow->forward = calloc(m + 1, 1);
+	flow->backward = calloc(m + 1, 1);
+	flow->sourceflow = calloc(n + 1, sizeof(int));
+	flow->sinkflow = calloc(n + 1, sizeof(int));
+	flow->queue = malloc((2 * n + 1) * sizeof(int));
+	flow->prevnode = malloc((2 * n + 1) * sizeof(int));
+	flow->prevarc = malloc((2 * n + 1) * sizeof(char *));
+	flow->visited = malloc((2 * n + 1) * sizeof(bool));
+	if (flow->cap == NULL || flow->forward == NULL
+			|| flow->backward == NULL || flow->sourceflow == NULL
+			|| flow->sinkflow == NULL || flow->queue == NULL
+			|| flow->prevnode == NULL || flow->prevarc == NULL
+			|| flow->visited == NULL) {
+		fprintf(stderr, "Not enough memory for the flow check\n");
+		free_flow(flow);
+		return NULL;
+	}
+	return flow;
+}
+
+/** Returns true if the connection is crossed by a connection with bridges. */
+bool crossed_connection(hconnection *connection) {
+	hcrosselem *cross;
+	for (cross = connection->firstcross; cross != NULL;
+			cross = cross->nextcross) {
+		if (*(cross->pbridges)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/** Returns how many bridges can still be added to the connection. */
+int connection_capacity(hconnection *connection) {
+	int cap = MAX_CONNECTION_BRIDGES - connection->bridges;
+	if (cap > *(connection->ppendbridges1)) {
+		cap = *(connection->ppendbridges1);
+	}
+	if (cap > *(connection->ppendbridges2)) {
+		cap = *(connection->ppendbridges2);
+	}
+	return cap;
+}
+
+/** Sets the capacity of each connection not decided before the island with
+ * the given index (the maximum of bridges that it can still get) and
+ * removes the flow that exceeds the new capacities. */
+void update_flow_capacities(hboard *board, hflow *flow, int idx) {
+	hisland *island;
+	hconnection *conn;
+	int i, dir, c, j, cap, excess;
+	for (i = 0; i < board->num_islands; i++) {
+		island = board->islands + i;
+		for (dir = RIGHT; dir <= DOWN; dir++) {
+			conn = island->connections[dir];
+			if (conn == board->out_connection) {
+				continue;
+			}
+			c = connection_index(board, conn);
+			j = island_index(board, island->islands[dir]);
+			cap = i >= idx && ! crossed_connection(conn)
+					? connection_capacity(conn) : 0;
+			flow->cap[c] = cap;
+			if ((excess = flow->forward[c] - cap) > 0) {
+				flow->forward[c] = cap;
+				flow->sourceflow[i] -= excess;
+				flow->sinkflow[j] -= excess;
+			}
+			if ((excess = flow->backward[c] - cap) > 0) {
+				flow->backward[c] = cap;
+				flow->sourceflow[j] -= excess;
+				flow->sinkflow[i] -= excess;
+			}
+		}
+	}
+}
+
+/** Removes the flow from the source and to the sink that exceeds the pending
+ * bridges of each island, removing it also from its connections. */
+void update_flow_pendings(hboard *board, hflow *flow) {
+	hisland *island;
+	char *arc;
+	int i, dir, c, j, excess;
+	for (i = 0; i < board->num_islands; i++) {
+		island = board->islands + i;
+		for (dir = 0; dir < DIRECTIONS; dir++) {
+			if (island->connections[dir] == board->out_connection) {
+				continue;
+			}
+			c = connection_index(board, island->connections[dir]);
+			j = island_index(board, island->islands[dir]);
+			excess = flow->sourceflow[i] - island->pendbridges;
+			arc = arc_flow(flow, c, dir, false);
+			if (excess > 0 && *arc > 0) {
+				excess = excess < *arc ? excess : *arc;
+				*arc -= excess;
+				flow->sourceflow[i] -= excess;
+				flow->sinkflow[j] -= excess;
+			}
+			excess = flow->sinkflow[i] - island->pendbridges;
+			arc = arc_flow(flow, c, dir, true);
+			if (excess > 0 && *arc > 0) {
+				excess = excess < *arc ? excess : *arc;
+				*arc -= excess;
+				flow->sinkflow[i] -= excess;
+				flow->sourceflow[j] -= excess;
+			}
+		}
+	}
+}
+
+/** Finds a path from the source to the sink with free capacity (searching
+ * in breadth first order) and adds one unit of flow to it, or returns false
+ * if there is no such path. The nodes of the islands that send the flow are
+ * numbered from 0 and the nodes that receive it are numbered from n, and the
+ * path goes back from a receiving node to a sending one removing flow. */
+bool augment_flow(hboard *board, hflow *flow) {
+	int n = board->num_islands, head = 0, tail = 0;
+	int node, next, i, dir, c, j;
+	hisland *island;
+	char *arc;
+	for (i = 0; i < 2 * n; i++) {
+		flow->visited[i] = false;
+	}
+	for (i = 0; i < n; i++) {
+		if (flow->sourceflow[i] < board->islands[i].pendbridges) {
+			flow->visited[i] = true;
+			flow->prevnode[i] = -1;
+			flow->queue[tail++] = i;
+		}
+	}
+	while (head < tail) {
+		node = flow->queue[head++];
+		i = node < n ? node : node - n;
+		island = board->islands + i;
+		if (node >= n && flow->sinkflow[i] < island->pendbridges) {
+			flow->sinkflow[i]++;
+			for (; flow->prevnode[node] > -1;
+					node = flow->prevnode[node]) {
+				*(flow->prevarc[node]) += node >= n ? 1 : -1;
+			}
+			flow->sourceflow[node]++;
+			return true;
+		}
+		for (dir = 0; dir < DIRECTIONS; dir++) {
+			if (island->connections[dir] == board->out_connection) {
+				continue;
+			}
+			c = connection_index(board, island->connections[dir]);
+			j = island_index(board, island->islands[dir]);
+			arc = arc_flow(flow, c, dir, node >= n);
+			next = node < n ? n + j : j;
+			if (flow->visited[next] || (node < n
+					? *arc >= flow->cap[c] : *arc == 0)) {
+				continue;
+			}
+			flow->visited[next] = true;
+			flow->prevnode[next] = node;
+			flow->prevarc[next] = arc;
+			flow->queue[tail++] = next;
+		}
+	}
+	return false;
+}
+
+/** Checks if the pending bridges can still be built in the connections not
+ * decided before the island with the given index, updating the flow. */
+bool check_flow(hboard *board, hflow *flow, int idx) {
+	int i, pending = 0, total = 0;
+	update_flow_capacities(board, flow, idx);
+	update_flow_pendings(board, flow);
+	for (i = 0; i < board->num_islands; i++) {
+		pending += board->islands[i].pendbridges;
+		total += flow->sourceflow[i];
+	}
+	while (total < pending && augment_flow(board, flow)) {
+		total++;
+		board->stats.augmentations++;
+	}
+	return total == pending;
+}
+
+/** Implication graph over the presence of bridges in each connection, where
+ * the literal 2 * c means that the connection c has bridges and the literal
+ * 2 * c + 1 means that it has none. Each clause "a or b" adds the edges
+ * "not a implies b" and "not b implies a". The clauses of the crossings
+ * (two crossing connections cannot have bridges at once) and of the pairs
+ * of islands of 1 bridge (their connection would leave them isolated) do
+ * not change, so they are added once, and the clauses of the bridges added
+ * by the search and of the pending bridges of each island are added again
+ * in each check after them. The bridges cannot be built if a literal and its
+ * negation are in the same strongly connected component of the graph. */
+struct st_himplications {
+	int period, num_literals, max_edges;
+	int num_edges, num_static_edges, num_units, num_static_units;
+	int *from, *to, *units;
+	int *first, *adjacent;
+	int *index, *lowlink, *stack, *component, *queue;
+	int counter, stacksize, num_components;
+	bool *onstack, *implied;
+};
+
+/** Returns the literal of the connection with the given index having bridges
+ * or not having them. */
+int presence_literal(int conn, bool present) {
+	return 2 * conn + (present ? 0 : 1);
+}
+
+/** Adds the clause "a or b" to the implication graph. When both literals are
+ * equal the clause means that the literal is true. */
+void add_clause(himplications *impl, int a, int b) {
+	impl->from[impl->num_edges] = a ^ 1;
+	impl->to[impl->num_edges++] = b;
+	if (a == b) {
+		impl->units[impl->num_units++] = a;
+	} else {
+		impl->from[impl->num_edges] = b ^ 1;
+		impl->to[impl->num_edges++] = a;
+	}
+}
+
+/** Returns the connection whose number of bridges is in the given address. */
+hconnection *bridges_owner(char *pbridges) {
+	return (hconnection *) (pbridges - offsetof(hconnection, bridges));
+}
+
+/** Frees the implication graph and its arrays. */
+void free_implications(himplications *impl) {
+	free(impl->from);
+	free(impl->to);
+	free(impl->units);
+	free(impl->first);
+	free(impl->adjacent);
+	free(impl->index);
+	free(impl->lowlink);
+	free(impl->stack);
+	free(impl->component);
+	free(impl->queue);
+	free(impl->onstack);
+	free(impl->implied);
+	free(impl);
+}
+
+/** Creates the implication graph to check the board every given number of
+ * islands, with the clauses that do not change. The board must have all its
+ * islands. */
+himplications *new_implications(hboard *board, int period) {
+	himplications *impl;
+	hconnection *conn;
+	hcrosselem *cross;
+	int n = board->num_islands, m = board->num_connections, c, other, l;
+	if ((impl = calloc(1, sizeof(himplications))) == NULL) {
+		return NULL;
+	}
+	impl->period = period;
+	impl->num_literals = l = 2 * m;
+	impl->max_edges = 2 * board->num_crosselems + 2 * m + 16 * n + 1;
+	impl->from = malloc(impl->max_edges * sizeof(int));
+	impl->to = malloc(impl->max_edges * sizeof(int));
+	impl->units = malloc((2 * m + 4 * n + 1) * sizeof(int));
+	impl->first = malloc((l + 1) * sizeof(int));
+	impl->adjacent = malloc(impl->max_edges * sizeof(int));
+	impl->index = malloc((l + 1) * sizeof(int));
+	impl->lowlink = malloc((l + 1) * sizeof(int));
+	impl->stack = malloc((l + 1) * sizeof(int));
+	impl->component = malloc((l + 1) * sizeof(int));
+	impl->queue = malloc((l + 1) * sizeof(int));
+	impl->onstack = malloc((l + 1) * sizeof(bool));
+	impl->implied = malloc((l + 1) * sizeof(bool));
+	if (impl->from == NULL || impl->to == NULL || impl->units == NULL
+			|| impl->first == NULL || impl->adjacent == NULL
+			|| impl->index == NULL || impl->lowlink == NULL
+			|| impl->stack == NULL || impl->component == NULL
+			|| impl->queue == NULL || impl->onstack == NULL
+			|| impl->implied == NULL) {
+		fprintf(stderr, "Not enough memory for the implications\n");
+		free_implications(impl);
+		return NULL;
+	}
+	for (c = 0; c < m; c++) {
+		conn = board->connections + c;
+		for (cross = conn->firstcross; cross != NULL;
+				cross = cross->nextcross) {
+			other = connection_index(board,
+					bridges_owner(cross->pbridges));
+			if (other > c) {
+				add_clause(impl, presence_literal(c, false),
+						presence_literal(other, false));
+			}
+		}
+		if (n > 2 && pending_island(conn->ppendbridges1)
+				->expectbridges == 1
+				&& pending_island(conn->ppendbridges2)
+				->expectbridges == 1) {
+			add_clause(impl, presence_literal(c, false),
+					presence_literal(c, false));
+		}
+	}
+	impl->num_static_edges = impl->num_edges;
+	impl->num_static_units = impl->num_units;
+	return impl;
+}
+
+/** Adds the clauses of the island with the given index: each connection not
+ * decided yet (starting from an island after the given index) that the island
+ * needs to build its pending bridges with the capacities of the others must
+ * have bridges, and one of each pair of them too. Returns false if the island
+ * cannot build its pending bridges even with all of them. */
+bool add_island_clauses(hboard *board, himplications *impl, int i, int idx) {
+	hisland *island = board->islands + i;
+	int literals[DIRECTIONS], caps[DIRECTIONS];
+	int k = 0, total = 0, a, b, owner, dir;
+	for (dir = 0; dir < DIRECTIONS; dir++) {
+		if (island->connections[dir] == board->out_connection) {
+			continue;
+		}
+		owner = dir == RIGHT || dir == DOWN ? i
+				: island_index(board, island->islands[dir]);
+		if (owner < idx || connection_capacity(
+				island->connections[dir]) == 0) {
+			continue;
+		}
+		literals[k] = presence_literal(connection_index(board,
+				island->connections[dir]), true);
+		caps[k] = connection_capacity(island->connections[dir]);
+		total += caps[k++];
+	}
+	if (total < island->pendbridges) {
+		return false;
+	}
+	for (a = 0; a < k; a++) {
+		if (total - caps[a] < island->pendbridges) {
+			add_clause(impl, literals[a], literals[a]);
+		}
+		for (b = a + 1; b < k; b++) {
+			if (total - caps[a] - caps[b] < island->pendbridges) {
+				add_clause(impl, literals[a], literals[b]);
+			}
+		}
+	}
+	return true;
+}
+
+/** Visits the literal and the literals implied by it to find the strongly
+ * connected components of the graph (Tarjan's algorithm). */
+void visit_literal(himplications *impl, int v) {
+	int e, w;
+	impl->index[v] = impl->lowlink[v] = impl->counter++;
+	impl->stack[impl->stacksize++] = v;
+	impl->onstack[v] = true;
+	for (e = impl->first[v]; e < impl->first[v + 1]; e++) {
+		w = impl->adjacent[e];
+		if (impl->index[w] < 0) {
+			visit_literal(impl, w);
+			if (impl->lowlink[w] < impl->lowlink[v]) {
+				impl->lowlink[v] = impl->lowlink[w];
+			}
+		} else if (impl->onstack[w]
+				&& impl->index[w] < impl->lowlink[v]) {
+			impl->lowlink[v] = impl->index[w];
+		}
+	}
+	if (impl->lowlink[v] == impl->index[v]) {
+		do {
+			w = impl->stack[--impl->stacksize];
+			impl->onstack[w] = false;
+			impl->component[w] = impl->num_components;
+		} while (w != v);
+		impl->num_components++;
+	}
+}
+
+/** Sorts the edges of the graph by their first literal, so the literals
+ * implied by the literal v are adjacent[first[v]] to adjacent[first[v+1]-1].*/
+void sort_edges(himplications *impl) {
+	int l = impl->num_literals, e, v;
+	for (v = 0; v <= l; v++) {
+		impl->first[v] = 0;
+	}
+	for (e = 0; e < impl->num_edges; e++) {
+		impl->first[impl->from[e] + 1]++;
+	}
+	for (v = 0; v < l; v++) {
+		impl->first[v + 1] += impl->first[v];
+	}
+	for (e = 0; e < impl->num_edges; e++) {
+		impl->adjacent[impl->first[impl->from[e]]++] = impl->to[e];
+	}
+	for (v = l; v > 0; v--) {
+		impl->first[v] = impl->first[v - 1];
+	}
+	impl->first[0] = 0;
+}
+
+/** Counts the literals implied by the true literals (the clauses with equal
+ * literals), which are the presences and absences of bridges forced by the
+ * bridges added before the island with the current index. */
+int count_implied(himplications *impl) {
+	int head = 0, tail = 0, v, e, u;
+	for (v = 0; v < impl->num_literals; v++) {
+		impl->implied[v] = false;
+	}
+	for (u = 0; u < impl->num_units; u++) {
+		if (! impl->implied[impl->units[u]]) {
+			impl->implied[impl->units[u]] = true;
+			impl->queue[tail++] = impl->units[u];
+		}
+	}
+	while (head < tail) {
+		v = impl->queue[head++];
+		for (e = impl->first[v]; e < impl->first[v + 1]; e++) {
+			if (! impl->implied[impl->adjacent[e]]) {
+				impl->implied[impl->adjacent[e]] = true;
+				impl->queue[tail++] = impl->adjacent[e];
+			}
+		}
+	}
+	return tail;
+}
+
+/** Checks if the bridges added before the island with the given index can
+ * be completed without contradicting the clauses of the implication graph. */
+bool check_implications(hboard *board, himplications *impl, int idx) {
+	hisland *island;
+	hconnection *conn;
+	int i, dir, c, v;
+	impl->num_edges = impl->num_static_edges;
+	impl->num_units = impl->num_static_units;
+	for (i = 0; i < board->num_islands; i++) {
+		island = board->islands + i;
+		for (dir = RIGHT; dir <= DOWN; dir++) {
+			conn = island->connections[dir];
+			if (conn == board->out_connection) {
+				continue;
+			}
+			c = connection_index(board, conn);
+			if (i < idx || connection_capacity(conn) == 0) {
+				v = presence_literal(c, conn->bridges > 0);
+				add_clause(impl, v, v);
+			}
+		}
+		if (i >= idx && ! add_island_clauses(board, impl, i, idx)) {
+			return false;
+		}
+	}
+	sort_edges(impl);
+	impl->counter = 0;
+	impl->stacksize = 0;
+	impl->num_components = 0;
+	for (v = 0; v < impl->num_literals; v++) {
+		impl->index[v] = -1;
+		impl->onstack[v] = false;
+	}
+	for (v = 0; v < impl->num_literals; v++) {
+		if (impl->index[v] < 0) {
+			visit_literal(impl, v);
+		}
+	}
+	for (v = 0; v < impl->num_literals; v += 2) {
+		if (impl->component[v] == impl->component[v + 1]) {
+			return false;
+		}
+	}
+	board->stats.implied += count_implied(impl);
+	return true;
+}
+
+/** Search of the cut edges of the graph of the islands with the connections
+ * that have bridges or can still have them: a connection that leaves some
+ * islands isolated from the others without it must have bridges, because
+ * the solution must be connected. The islands are numbered in depth first
+ * order and the lowest number reachable from each island with one edge out
+ * of its subtree is kept (Tarjan's low-link). */
+struct st_hcuts {
+	int period, counter;
+	int *order, *low, *forcedcount;
+	bool *forced;
+};
+
+/** Frees the cut edges search and its arrays. */
+void free_cuts(hcuts *cuts) {
+	free(cuts->order);
+	free(cuts->low);
+	free(cuts->forcedcount);
+	free(cuts->forced);
+	free(cuts);
+}
+
+/** Creates the cut edges search to check the board every given number of
+ * islands. The board must have all its islands. */
+hcuts *new_cuts(hboard *board, int period) {
+	hcuts *cuts;
+	int n = board->num_islands, m = board->num_connections;
+	if ((cuts = calloc(1, sizeof(hcuts))) == NULL) {
+		return NULL;
+	}
+	cuts->period = period;
+	cuts->order = malloc((n + 1) * sizeof(int));
+	cuts->low = malloc((n + 1) * sizeof(int));
+	cuts->forcedcount = malloc((n + 1) * sizeof(int));
+	cuts->forced = malloc((m + 1) * sizeof(bool));
+	if (cuts->order == NULL || cuts->low == NULL
+			|| cuts->forcedcount == NULL || cuts->forced == NULL) {
+		fprintf(stderr, "Not enough memory for the cut edges\n");
+		free_cuts(cuts);
+		return NULL;
+	}
+	return cuts;
+}
+
+/** Returns true if the connection of the island in the given direction has
+ * bridges or can still have them when the islands before the given index
+ * have been decided. */
+bool usable_connection(hboard *board, hisland *island, int dir, int idx) {
+	hconnection *conn = island->connections[dir];
+	int owner;
+	if (conn == board->out_connection) {
+		return false;
+	}
+	if (conn->bridges) {
+		return true;
+	}
+	owner = dir == RIGHT || dir == DOWN ? island_index(board, island)
+			: island_index(board, island->islands[dir]);
+	return owner >= idx && connection_capacity(conn) > 0
+			&& ! crossed_connection(conn);
+}
+
+/** Visits the island and the islands reachable from it in depth first order
+ * (not going back by the connection of its parent), marking as forced the
+ * cut edges without bridges yet. */
+void visit_cut_island(hboard *board, hcuts *cuts, int v, int parentconn,
+		int idx) {
+	hisland *island = board->islands + v;
+	int dir, c, w;
+	cuts->order[v] = cuts->low[v] = cuts->counter++;
+	for (dir = 0; dir < DIRECTIONS; dir++) {
+		if (! usable_connection(board, island, dir, idx)) {
+			continue;
+		}
+		c = connection_index(board, island->connections[dir]);
+		w = island_index(board, island->islands[dir]);
+		if (c == parentconn) {
+			continue;
+		}
+		if (cuts->order[w] < 0) {
+			visit_cut_island(board, cuts, w, c, idx);
+			if (cuts->low[w] < cuts->low[v]) {
+				cuts->low[v] = cuts->low[w];
+			}
+			if (cuts->low[w] > cuts->order[v] && ! island
+					->connections[dir]->bridges) {
+				cuts->forced[c] = true;
+				cuts->forcedcount[v]++;
+				cuts->forcedcount[w]++;
+				board->stats.forced_bridges++;
+			}
+		} else if (cuts->order[w] < cuts->low[v]) {
+			cuts->low[v] = cuts->order[w];
+		}
+	}
+}
+
+/** Checks if the islands can still be connected when the islands before the
+ * given index have been decided: all of them must be reachable with usable
+ * connections, two forced connections cannot cross, and an island cannot
+ * have more forced connections than pending bridges. */
+bool check_cuts(hboard *board, hcuts *cuts, int idx) {
+	hcrosselem *cross;
+	int i, c;
+	for (i = 0; i < board->num_islands; i++) {
+		cuts->order[i] = -1;
+		cuts->forcedcount[i] = 0;
+	}
+	for (c = 0; c < board->num_connections; c++) {
+		cuts->forced[c] = false;
+	}
+	cuts->counter = 0;
+	visit_cut_island(board, cuts, 0, -1, idx);
+	if (cuts->counter < board->num_islands) {
+		return false;
+	}
+	for (i = 0; i < board->num_islands; i++) {
+		if (cuts->forcedcount[i] > board->islands[i].pendbridges) {
+			return false;
+		}
+	}
+	for (c = 0; c < board->num_connections; c++) {
+		if (! cuts->forced[c]) {
+			continue;
+		}
+		for (cross = board->connections[c].firstcross; cross != NULL;
+				cross = cross->nextcross) {
+			if (cuts->forced[connection_index(board,
+					bridges_owner(cross->pbridges))]) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/** Linear relaxation of the bridges of the connections not decided yet:
+ * each one has a real number of bridges between 0 and its capacity, the sum
+ * in each island must be its pending bridges and two crossing connections
+ * cannot have more than MAX_CONNECTION_BRIDGES bridges together. If not even
+ * real numbers of bridges exist, the branch cannot have a solution. The
+ * tableau of the simplex method has one row per constraint (the islands
+ * first, with an artificial variable each, and then the inequalities, with
+ * a slack variable each) and one column per variable, and it is minimized
+ * the sum of the artificial variables (phase 1). The relaxation only has the
+ * islands of a window from the current one that fits in LP_MAX_ROWS rows
+ * (dropping constraints keeps it a relaxation), so the tableau is bounded
+ * in big boards. The last feasible point is kept and checked first in the
+ * next nodes (warm start), so the simplex only runs when the bridges added
+ * since then have made it infeasible. When it is feasible, the connections
+ * whose reduced costs show that they only have real solutions with 0 bridges
+ * (or with their capacity) are fixed until the search returns to the island
+ * of the check (a stack of fixed connections). */
+struct st_hlp {
+	int period, num_rows, num_cols, num_vars, num_equalities;
+	int max_rows, max_cols, max_vars, window_start, window_end;
+	double *tableau, *rhs, *cost;
+	int *basis, *vars, *varindex, *boundvar, *nonzeros;
+	bool *basic;
+	double *point;
+	bool has_point;
+	int *fixconns, *fixdepths, num_fixes;
+	char *fixbridges;
+};
+
+/** Frees the linear relaxation and its arrays. */
+void free_lp(hlp *lp) {
+	free(lp->tableau);
+	free(lp->rhs);
+	free(lp->cost);
+	free(lp->basis);
+	free(lp->vars);
+	free(lp->varindex);
+	free(lp->boundvar);
+	free(lp->nonzeros);
+	free(lp->basic);
+	free(lp->point);
+	free(lp->fixconns);
+	free(lp->fixdepths);
+	free(lp->fixbridges);
+	free(lp);
+}
+
+/** Creates the linear relaxation to check the board every given number of
+ * islands, with room for the constraints of all its islands, crossings and
+ * connections up to LP_MAX_ROWS rows (each island of a window has at most
+ * four variables). The board must have all its islands. */
+hlp *new_lp(hboard *board, int period) {
+	hlp *lp;
+	int n = board->num_islands, m = board->num_connections, c;
+	long long rows = (long long) n + board->num_crosselems + m + 1;
+	if ((lp = calloc(1, sizeof(hlp))) == NULL) {
+		return NULL;
+	}
+	lp->period = period;
+	lp->max_rows = rows < LP_MAX_ROWS ? (int) rows : LP_MAX_ROWS;
+	lp->max_vars = m < 4 * lp->max_rows ? m : 4 * lp->max_rows;
+	lp->max_cols = lp->max_vars + lp->max_rows;
+	lp->tableau = malloc((size_t) lp->max_rows * lp->max_cols
+			* sizeof(double));
+	lp->rhs = malloc(lp->max_rows * sizeof(double));
+	lp->cost = malloc(lp->max_cols * sizeof(double));
+	lp->basis = malloc(lp->max_rows * sizeof(int));
+	lp->vars = malloc((lp->max_vars + 1) * sizeof(int));
+	lp->varindex = malloc((m + 1) * sizeof(int));
+	lp->boundvar = malloc(lp->max_rows * sizeof(int));
+	lp->nonzeros = malloc(lp->max_cols * sizeof(int));
+	lp->basic = malloc(lp->max_cols * sizeof(bool));
+	lp->point = calloc(m + 1, sizeof(double));
+	lp->fixconns = malloc((m + 1) * sizeof(int));
+	lp->fixdepths = malloc((m + 1) * sizeof(int));
+	lp->fixbridges = malloc(m + 1);
+	if (lp->tableau == NULL || lp->rhs == NULL || lp->cost == NULL
+			|| lp->basis == NULL || lp->vars == NULL
+			|| lp->varindex == NULL || lp->boundvar == NULL
+			|| lp->nonzeros == NULL || lp->basic == NULL
+			|| lp->point == NULL || lp->fixconns == NULL
+			|| lp->fixdepths == NULL || lp->fixbridges == NULL) {
+		fprintf(stderr, "Not enough memory for the relaxation\n");
+		free_lp(lp);
+		return NULL;
+	}
+	for (c = 0; c < m; c++) {
+		lp->varindex[c] = -1;
+		lp->fixbridges[c] = -1;
+	}
+	return lp;
+}
+
+/** Returns the element of the tableau in the given row and column. */
+double *lp_cell(hlp *lp, int row, int col) {
+	return lp->tableau + (size_t) row * lp->max_cols + col;
+}
+
+/** Returns the capacity of the connection in the relaxation when the islands
+ * before the given index have been decided, or 0 if it is decided. */
+int lp_capacity(hboard *board, hconnection *connection, int idx) {
+	if (connection_end(board, connection, true) < idx
+			|| crossed_connection(connection)) {
+		return 0;
+	}
+	return connection_capacity(connection);
+}
+
+/** Returns true if the last feasible point is still feasible for the islands
+ * of its window from the given index, while at least half of the window is
+ * ahead of the index (or it reaches the last island). */
+bool lp_point_feasible(hboard *board, hlp *lp, int idx) {
+	hisland *island;
+	hconnection *conn;
+	hcrosselem *cross;
+	double sum;
+	int i, dir, c, cap;
+	if (! lp->has_point || (lp->window_end < board->num_islands
+			&& 2 * (lp->window_end - idx)
+			< lp->window_end - lp->window_start)) {
+		return false;
+	}
+	for (c = 0; c < board->num_connections; c++) {
+		conn = board->connections + c;
+		cap = lp_capacity(board, conn, idx);
+		if (lp->point[c] > cap + LP_EPSILON) {
+			return false;
+		}
+		for (cross = conn->firstcross; cross != NULL;
+				cross = cross->nextcross) {
+			if (lp->point[c] + lp->point[connection_index(board,
+					bridges_owner(cross->pbridges))]
+					> MAX_CONNECTION_BRIDGES + LP_EPSILON) {
+				return false;
+			}
+		}
+	}
+	for (i = idx; i < lp->window_end; i++) {
+		island = board->islands + i;
+		sum = 0;
+		for (dir = 0; dir < DIRECTIONS; dir++) {
+			if (island->connections[dir] != board->out_connection) {
+				sum += lp->point[connection_index(board,
+						island->connections[dir])];
+			}
+		}
+		if (sum < island->pendbridges - LP_EPSILON
+				|| sum > island->pendbridges + LP_EPSILON) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Returns true if the connection needs a row for its capacity, because the
+ * pending bridges of its islands do not limit it as much. */
+bool lp_bounded(hboard *board, hconnection *connection, int idx) {
+	int cap = lp_capacity(board, connection, idx);
+	return cap < *(connection->ppendbridges1)
+			&& cap < *(connection->ppendbridges2);
+}
+
+/** Chooses the variables of the relaxation from the island with the given
+ * index: the open connections of the islands of the window, which grows
+ * while the variables and the rows of the constraints fit in the tableau.
+ * Returns the number of rows. */
+int choose_lp_window(hboard *board, hlp *lp, int idx) {
+	hisland *island;
+	hconnection *conn;
+	hcrosselem *cross;
+	int i, k, dir, c, first, rows = 0, newrows;
+	bool full = false;
+	for (k = 0; k < lp->num_vars; k++) {
+		lp->varindex[lp->vars[k]] = -1;
+	}
+	lp->num_vars = 0;
+	for (i = idx; i < board->num_islands && ! full; i++) {
+		island = board->islands + i;
+		first = lp->num_vars;
+		newrows = island->pendbridges > 0;
+		for (dir = 0; dir < DIRECTIONS && ! full; dir++) {
+			conn = island->connections[dir];
+			if (conn == board->out_connection) {
+				continue;
+			}
+			c = connection_index(board, conn);
+			if (lp->varindex[c] > -1
+					|| lp_capacity(board, conn, idx) == 0) {
+				continue;
+			}
+			if (lp->num_vars == lp->max_vars) {
+				full = true;
+				break;
+			}
+			lp->varindex[c] = lp->num_vars;
+			lp->vars[lp->num_vars++] = c;
+			for (cross = conn->firstcross; cross != NULL;
+					cross = cross->nextcross) {
+				if (lp->varindex[connection_index(board,
+						bridges_owner(cross->pbridges))]
+						> -1) {
+					newrows++;
+				}
+			}
+			newrows += lp_bounded(board, conn, idx);
+		}
+		if (full || rows + newrows > lp->max_rows) {
+			for (k = first; k < lp->num_vars; k++) {
+				lp->varindex[lp->vars[k]] = -1;
+			}
+			lp->num_vars = first;
+			break;
+		}
+		rows += newrows;
+	}
+	lp->window_start = idx;
+	lp->window_end = i;
+	return rows;
+}
+
+/** Adds a row to the tableau with the given right hand side, and returns it.
+ * The row has no coefficients yet. */
+int add_lp_row(hlp *lp, double rhs) {
+	int row = lp->num_rows++, col;
+	for (col = 0; col < lp->num_cols; col++) {
+		*lp_cell(lp, row, col) = 0;
+	}
+	lp->rhs[row] = rhs;
+	lp->boundvar[row] = -1;
+	return row;
+}
+
+/** Builds the tableau of the relaxation when the islands before the given
+ * index have been decided. Returns false if an island has pending bridges
+ * but no connection to build them. */
+bool build_lp(hboard *board, hlp *lp, int idx) {
+	hisland *island;
+	hconnection *conn;
+	hcrosselem *cross;
+	int i, dir, c, other, row, k;
+	lp->num_rows = 0;
+	row = choose_lp_window(board, lp, idx);
+	lp->num_cols = lp->num_vars + row;
+	for (i = idx; i < lp->window_end; i++) {
+		island = board->islands + i;
+		if (island->pendbridges == 0) {
+			continue;
+		}
+		row = add_lp_row(lp, island->pendbridges);
+		k = 0;
+		for (dir = 0; dir < DIRECTIONS; dir++) {
+			conn = island->connections[dir];
+			if (conn == board->out_connection) {
+				continue;
+			}
+			c = connection_index(board, conn);
+			if (lp->varindex[c] > -1) {
+				*lp_cell(lp, row, lp->varindex[c]) = 1;
+				k++;
+			}
+		}
+		if (k == 0) {
+			return false;
+		}
+	}
+	lp->num_equalities = lp->num_rows;
+	for (k = 0; k < lp->num_vars; k++) {
+		c = lp->vars[k];
+		conn = board->connections + c;
+		for (cross = conn->firstcross; cross != NULL;
+				cross = cross->nextcross) {
+			other = connection_index(board,
+					bridges_owner(cross->pbridges));
+			if (other > c && lp->varindex[other] > -1) {
+				row = add_lp_row(lp, MAX_CONNECTION_BRIDGES);
+				*lp_cell(lp, row, k) = 1;
+				*lp_cell(lp, row, lp->varindex[other]) = 1;
+			}
+		}
+		if (lp_bounded(board, conn, idx)) {
+			row = add_lp_row(lp, lp_capacity(board, conn, idx));
+			*lp_cell(lp, row, k) = 1;
+			lp->boundvar[row] = k;
+		}
+	}
+	for (row = 0; row < lp->num_rows; row++) {
+		*lp_cell(lp, row, lp->num_vars + row) = 1;
+		lp->basis[row] = lp->num_vars + row;
+	}
+	return true;
+}
+
+/** Pivots the tableau in the given row and column, only updating the columns
+ * where the pivot row is not zero (the tableau is mostly zeros). */
+void pivot_lp(hlp *lp, int prow, int pcol) {
+	double factor, pivot = *lp_cell(lp, prow, pcol);
+	int row, col, k, num_nonzeros = 0;
+	for (col = 0; col < lp->num_cols; col++) {
+		if (*lp_cell(lp, prow, col) != 0) {
+			*lp_cell(lp, prow, col) /= pivot;
+			lp->nonzeros[num_nonzeros++] = col;
+		}
+	}
+	lp->rhs[prow] /= pivot;
+	for (row = 0; row < lp->num_rows; row++) {
+		factor = *lp_cell(lp, row, pcol);
+		if (row == prow || factor == 0) {
+			continue;
+		}
+		for (k = 0; k < num_nonzeros; k++) {
+			col = lp->nonzeros[k];
+			*lp_cell(lp, row, col) -= factor
+					* *lp_cell(lp, prow, col);
+		}
+		lp->rhs[row] -= factor * lp->rhs[prow];
+	}
+	factor = lp->cost[pcol];
+	for (k = 0; k < num_nonzeros; k++) {
+		col = lp->nonzeros[k];
+		lp->cost[col] -= factor * *lp_cell(lp, prow, col);
+	}
+	lp->basis[prow] = pcol;
+}
+
+/** Runs the phase 1 of the simplex method with Bland's rule (the first
+ * column that improves enters and the first row of the minimum ratio leaves)
+ * and returns the minimum sum of the artificial variables, saving the point
+ * found. The artificial variables are the slacks of the equalities. */
+double minimize_lp(hboard *board, hlp *lp) {
+	double ratio, best, sum = 0;
+	int row, col, prow, pcol, k;
+	for (col = 0; col < lp->num_cols; col++) {
+		lp->cost[col] = 0;
+		if (col >= lp->num_vars + lp->num_equalities
+				|| col < lp->num_vars) {
+			for (row = 0; row < lp->num_equalities; row++) {
+				lp->cost[col] -= *lp_cell(lp, row, col);
+			}
+		}
+	}
+	while (true) {
+		for (pcol = 0; pcol < lp->num_cols
+				&& lp->cost[pcol] > -LP_EPSILON; pcol++);
+		if (pcol == lp->num_cols) {
+			break;
+		}
+		prow = -1;
+		best = 0;
+		for (row = 0; row < lp->num_rows; row++) {
+			if (*lp_cell(lp, row, pcol) <= LP_EPSILON) {
+				continue;
+			}
+			ratio = lp->rhs[row] / *lp_cell(lp, row, pcol);
+			if (prow < 0 || ratio < best - LP_EPSILON
+					|| (ratio < best + LP_EPSILON
+					&& lp->basis[row] < lp->basis[prow])) {
+				prow = row;
+				best = ratio;
+			}
+		}
+		if (prow < 0) {
+			break;
+		}
+		pivot_lp(lp, prow, pcol);
+		board->stats.lp_pivots++;
+	}
+	for (row = 0; row < lp->num_rows; row++) {
+		if (lp->basis[row] >= lp->num_vars && lp->basis[row]
+				< lp->num_vars + lp->num_equalities) {
+			sum += lp->rhs[row];
+		}
+	}
+	for (k = 0; k < board->num_connections; k++) {
+		lp->point[k] = 0;
+	}
+	for (row = 0; row < lp->num_rows; row++) {
+		if (lp->basis[row] < lp->num_vars) {
+			lp->point[lp->vars[lp->basis[row]]] = lp->rhs[row];
+		}
+	}
+	return sum;
+}
+
+/** Forgets the connections fixed in the checks of the given island or of the
+ * islands after it, because the search has returned to it. */
+void pop_lp_fixes(hlp *lp, int idx) {
+	while (lp->num_fixes > 0 && lp->fixdepths[lp->num_fixes - 1] >= idx) {
+		lp->fixbridges[lp->fixconns[--lp->num_fixes]] = -1;
+	}
+}
+
+/** Fixes the bridges of the given connection in the subtree of the island
+ * with the given index, unless an earlier check has already fixed them. */
+void push_lp_fix(hboard *board, hlp *lp, int c, int bridges, int idx) {
+	if (lp->fixbridges[c] > -1) {
+		return;
+	}
+	lp->fixbridges[c] = bridges;
+	lp->fixconns[lp->num_fixes] = c;
+	lp->fixdepths[lp->num_fixes++] = idx;
+	board->stats.lp_fixed++;
+}
+
+/** Fixes the connections by their reduced costs after a feasible phase 1.
+ * For any point of the relaxation, the sum of the artificial variables is
+ * the minimum found plus the reduced cost of each non-basic column by its
+ * value, so a solution (with sum 0) cannot give 1 bridge or more to a
+ * non-basic connection with a reduced cost greater than what the negative
+ * reduced costs (rounding errors) could subtract, nor leave a bound row
+ * with non-basic slack below its capacity. The values of the non-basic
+ * columns are at most MAX_EXPECTED_BRIDGES. */
+void fix_lp_variables(hboard *board, hlp *lp, int idx) {
+	double margin = 0;
+	int row, col, k;
+	for (col = 0; col < lp->num_cols; col++) {
+		lp->basic[col] = false;
+	}
+	for (row = 0; row < lp->num_rows; row++) {
+		lp->basic[lp->basis[row]] = true;
+	}
+	for (col = 0; col < lp->num_cols; col++) {
+		if (! lp->basic[col] && lp->cost[col] < 0) {
+			margin -= lp->cost[col];
+		}
+	}
+	margin = margin * MAX_EXPECTED_BRIDGES + LP_FIX_MARGIN;
+	for (k = 0; k < lp->num_vars; k++) {
+		if (! lp->basic[k] && lp->cost[k] > margin) {
+			push_lp_fix(board, lp, lp->vars[k], 0, idx);
+		}
+	}
+	for (row = lp->num_equalities; row < lp->num_rows; row++) {
+		col = lp->num_vars + row;
+		k = lp->boundvar[row];
+		if (k > -1 && ! lp->basic[col] && lp->cost[col] > margin) {
+			push_lp_fix(board, lp, lp->vars[k],
+					lp_capacity(board, board->connections
+					+ lp->vars[k], idx), idx);
+		}
+	}
+}
+
+/** Returns true if the island before the given index has given to one of
+ * its connections other bridges than the ones fixed by the relaxation. */
+bool violates_lp_fixes(hboard *board, hlp *lp, int idx) {
+	hisland *island = board->islands + (idx - 1);
+	hconnection *conn;
+	int dir, fixed;
+	for (dir = 0; dir < DIRECTIONS; dir++) {
+		conn = island->connections[dir];
+		if (conn == board->out_connection) {
+			continue;
+		}
+		fixed = lp->fixbridges[connection_index(board, conn)];
+		if (fixed > -1 && conn->bridges != fixed) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/** Checks if the relaxation of the bridges not decided before the island
+ * with the given index is feasible, first with the last feasible point,
+ * and fixes the connections of its reduced costs after the simplex. */
+bool check_lp(hboard *board, hlp *lp, int idx) {
+	struct timespec start, end;
+	bool feasible;
+	if (lp_point_feasible(board, lp, idx)) {
+		board->stats.lp_warm++;
+		return true;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	feasible = build_lp(board, lp, idx)
+			&& minimize_lp(board, lp) <= LP_EPSILON;
+	lp->has_point = feasible;
+	if (feasible) {
+		fix_lp_variables(board, lp, idx);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	board->stats.lp_nanos += (end.tv_sec - start.tv_sec) * 1000000000LL
+			+ (end.tv_nsec - start.tv_nsec);
+	return feasible;
+}
+
+/** Returns true if the search must not continue from the island with the
+ * given index because the bridges added before it cannot give a solution.
+ * Each check is done in the root and every given number of islands. */
+bool prune_node(hboard *board, int idx) {
+	board->stats.nodes++;
+	if (board->lp != NULL) {
+		pop_lp_fixes(board->lp, idx);
+		if (idx > 0 && violates_lp_fixes(board, board->lp, idx)) {
+			board->stats.lp_fix_prunes++;
+			return true;
+		}
+	}
+	if (board->flow != NULL && idx % board->flow->period == 0) {
+		board->stats.flow_checks++;
+		if (! check_flow(board, board->flow, idx)) {
+			board->stats.flow_prunes++;
+			return true;
+		}
+	}
+	if (board->implications != NULL
+			&& idx % board->implications->period == 0) {
+		board->stats.implication_checks++;
+		if (! check_implications(board, board->implications, idx)) {
+			board->stats.implication_prunes++;
+			return true;
+		}
+	}
+#ifdef CHECK_CONNECTED_SOLUTION
+	if (board->cuts != NULL && idx % board->cuts->period == 0) {
+		board->stats.cut_checks++;
+		if (! check_cuts(board, board->cuts, idx)) {
+			board->stats.cut_prunes++;
+			return true;
+		}
+	}
+#endif
+	if (board->lp != NULL && idx % board->lp->period == 0) {
+		board->stats.lp_checks++;
+		if (! check_lp(board, board->lp, idx)) {
+			board->stats.lp_prunes++;
+			return true;
+		}
+	}
+	return false;
+}
+
+/** Counters of the search for each island (by index), printed with
+ * --profile-islands: the visits of the island, the visits where its bridges
+ * could not be filled, the other orderings of its bridges tried after the
+ * first one and the nanoseconds spent in the subtrees of its visits
+ * (including the island), with the start of the current visit of each island
+ * for the searches that are not recursive. */
+struct st_hprofile {
+	long long *visits, *fill_failures, *reorders, *nanos, *starts;
+};
+
+void free_profile(hprofile *profile) {
+	free(profile->visits);
+	free(profile);
+}
+
+/** Creates the profile of the islands of the board with all its counters
+ * set to 0. The board must have all its islands. */
+hprofile *new_profile(hboard *board) {
+	hprofile *profile;
+	int n = board->num_islands;
+	if ((profile = calloc(1, sizeof(hprofile))) == NULL
+			|| (profile->visits = calloc(5 * (size_t) n + 1,
+			sizeof(long long))) == NULL) {
+		fprintf(stderr, "Not enough memory for the profile\n");
+		free(profile);
+		return NULL;
+	}
+	profile->fill_failures = profile->visits + n;
+	profile->reorders = profile->visits + 2 * n;
+	profile->nanos = profile->visits + 3 * n;
+	profile->starts = profile->visits + 4 * n;
+	return profile;
+}
+
+/** Prints the profile of the board: a grid with the geometry of print_board
+ * where each island shows its visits in a logarithmic scale from 1 to 9 (or
+ * 0 if it was not visited), and then the counters of each island as CSV. */
+void print_profile(hboard *board, FILE *out) {
+	hprofile *profile = board->profile;
+	FILE *boardout = board->out;
+	hisland *island;
+	long long max = 0;
+	int i, j, index = 0, level;
+	for (i = 0; i < board->num_islands; i++) {
+		if (profile->visits[i] > max) {
+			max = profile->visits[i];
+		}
+	}
+	board->out = out;
+	fprintf(out, "Island visits (from 1 to 9 = %lld, logarithmic):\n",
+			max);
+	for (i = 0; i < board->rows; i++) {
+		for (j = 0; j < board->cols; j++) {
+			island = board->islands + index;
+			if (index < board->num_islands && island->row == i
+					&& island->col == j) {
+				level = profile->visits[index] == 0 ? 0
+						: max == 1 ? 9 : 1 + (int) (8
+						* log(profile->visits[index])
+						/ log(max));
+				fprintf(out, "[%d]", level);
+				index++;
+			} else {
+				print_empty_position(board, i, j);
+			}
+			print_space_right(board, i, j + 1);
+		}
+		fprintf(out, "\n");
+		for (j = 0; j < board->cols; j++) {
+			print_space_down(board, i + 1, j);
+			fprintf(out, "  ");
+		}
+		fprintf(out, "\n");
+	}
+	fprintf(out, "\n");
+	board->out = boardout;
+	fprintf(out, "island,row,col,bridges,visits,fill_failures,reorders,"
+			"subtree_nanos\n");
+	for (i = 0; i < board->num_islands; i++) {
+		island = board->islands + i;
+		fprintf(out, "%d,%d,%d,%d,%lld,%lld,%lld,%lld\n", i,
+				island->row, island->col, island->expectbridges,
+				profile->visits[i], profile->fill_failures[i],
+				profile->reorders[i], profile->nanos[i]);
+	}
+}
+
+/** Finds all solutions by brute force without mandatory bridges,
+ * counting the work of each island if the board has a profile. */
+void find_solutions_from_island(hboard* board, int idx) {
+	hprofile *profile = board->profile;
+	long long start = 0;
+	int sampled = 0;
+	if (idx >= board->num_islands) {
+		if (check_connected_solution(board)) {
+			emit_solution(board);
+		}
+		return;
+	}
+	if (board->trace != NULL) {
+		sampled = idx < TRACE_DEPTH ? 1 : trace_sample(board->trace,
+				TRACE_DEEP_SEARCH);
+	}
+	if (profile != NULL) {
+		profile->visits[idx]++;
+	}
+	if (profile != NULL || sampled) {
+		start = monotonic_nanos();
+	}
+	if (! prune_node(board, idx)) {
+		if (fill_bridges(board->islands + idx)) {
 			find_solutions_from_island(board, idx + 1);
+			while (reorder_bridges(board->islands + idx)) {
+				if (profile != NULL) {
+					profile->reorders[idx]++;
+				}
+				find_solutions_from_island(board, idx + 1);
+			}
+		} else if (profile != NULL) {
+			profile->fill_failures[idx]++;
+		}
+	}
+	if (profile != NULL) {
+		profile->nanos[idx] += monotonic_nanos() - start;
+	}
+	if (sampled) {
+		trace_span(board->trace, "island", start, idx, sampled);
+	}
+}
+
+typedef enum enum_search_status {
+	SEARCH_SOLUTION = 0, SEARCH_PAUSED, SEARCH_FINISHED
+} search_status;
+
+/** State of the search of find_solutions_from_island kept out of the stack,
+ * so it can be stopped after any step and resumed later. The islands before
+ * the current index have their bridges added, and each island of the path
+ * is marked as started when its first ordering of bridges has been added,
+ * so when the search returns to it the bridges are reordered instead. */
+typedef struct st_hsearch {
+	hboard *board;
+	int idx;
+	bool *started;
+} hsearch;
+
+/** Initializes the search with an array of at least one mark per island. */
+bool init_search(hsearch *search, hboard *board, bool *started,
+		int max_started) {
+	if (max_started < board->num_islands) {
+		fprintf(stderr, "Maximum of search islands too small: %d\n",
+				max_started);
+		return false;
+	}
+	search->board = board;
+	search->idx = board->num_islands ? 0 : -1;
+	search->started = started;
+	memset(started, 0, board->num_islands);
+	return true;
+}
+
+/** Runs the search until the next solution is found (then the board has its
+ * bridges) or until the given remaining steps are consumed (then the search
+ * is paused) or until the whole tree is explored (then it is finished).
+ * The solutions are found in the same order of find_solutions_from_island,
+ * counting the work of each island if the board has a profile. */
+search_status run_search(hsearch *search, long *steps) {
+	hboard *board = search->board;
+	hprofile *profile = board->profile;
+	hisland *island;
+	int idx;
+	while ((idx = search->idx) > -1) {
+		if (*steps <= 0) {
+			return SEARCH_PAUSED;
+		}
+		(*steps)--;
+		if (idx >= board->num_islands) {
+			search->idx--;
+			if (check_connected_solution(board)) {
+				return SEARCH_SOLUTION;
+			}
+			continue;
+		}
+		island = board->islands + idx;
+		if (profile != NULL && ! search->started[idx]) {
+			profile->visits[idx]++;
+			profile->starts[idx] = monotonic_nanos();
+		}
+		if (! search->started[idx] && prune_node(board, idx)) {
+			if (profile != NULL) {
+				profile->nanos[idx] += monotonic_nanos()
+						- profile->starts[idx];
+			}
+			search->idx--;
+			continue;
+		}
+		if (search->started[idx] ? reorder_bridges(island)
+				: fill_bridges(island)) {
+			if (profile != NULL && search->started[idx]) {
+				profile->reorders[idx]++;
+			}
+			search->started[idx] = true;
+			if (++search->idx < board->num_islands) {
+				search->started[search->idx] = false;
+			}
+		} else {
+			if (profile != NULL) {
+				profile->fill_failures[idx] +=
+						! search->started[idx];
+				profile->nanos[idx] += monotonic_nanos()
+						- profile->starts[idx];
+			}
+			search->started[idx] = false;
+			search->idx--;
+		}
+	}
+	return SEARCH_FINISHED;
+}
+
+/** Iterator over the solutions of a board that gives them one by one when
+ * they are requested, so the caller can stop at any time or alternate the
+ * solutions of several boards. Each solution is given as the number of
+ * bridges of each connection, in the order of the array of connections. */
+typedef struct st_hiterator {
+	hsearch search;
+	char *bridges;
+} hiterator;
+
+/** Initializes the iterator with an array of at least one mark per island
+ * for the search and an array of at least one number per connection. */
+bool init_iterator(hiterator *iterator, hboard *board, bool *started,
+		int max_started, char *bridges, int max_bridges) {
+	if (max_bridges < board->num_connections) {
+		fprintf(stderr, "Maximum of solution bridges too small: %d\n",
+				max_bridges);
+		return false;
+	}
+	iterator->bridges = bridges;
+	return init_search(&iterator->search, board, started, max_started);
+}
+
+/** Returns the bridges of each connection of the next solution (which are
+ * also in the board until the next call), or NULL if there are no more. */
+const char *next_solution(hiterator *iterator) {
+	hboard *board = iterator->search.board;
+	long steps = LONG_MAX;
+	int i;
+	while (run_search(&iterator->search, &steps) == SEARCH_PAUSED) {
+		steps = LONG_MAX;
+	}
+	if (iterator->search.idx < 0) {
+		return NULL;
+	}
+	for (i = 0; i < board->num_connections; i++) {
+		iterator->bridges[i] = board->connections[i].bridges;
+	}
+	return iterator->bridges;
+}
+
+/** Sets the bridges of each connection of the board as given by an iterator.
+ * The pending bridges of the islands are not updated, so the board can only
+ * be printed or checked, but the search cannot continue. */
+void set_solution_bridges(hboard *board, const char *bridges) {
+	int i;
+	for (i = 0; i < board->num_connections; i++) {
+		board->connections[i].bridges = bridges[i];
+	}
+}
+
+/** Deletes all the bridges added by fill_bridges in the given island. */
+void clear_bridges(hisland *island) {
+	while (del_bridge(island->connections[RIGHT]));
+	while (del_bridge(island->connections[DOWN]));
+}
+
+/** Counts the orderings of bridges that fill_bridges and reorder_bridges
+ * can produce in the given island, leaving it without the added bridges. */
+int count_orderings(hisland *island) {
+	int total = 0;
+	if (fill_bridges(island)) {
+		total++;
+		while (reorder_bridges(island)) {
+			total++;
+		}
+	}
+	return total;
+}
+
+/** Adds the bridges of the ordering with the given position in the sequence
+ * produced by fill_bridges and reorder_bridges, or returns false if the
+ * island has not so many orderings (then no bridges are left added). */
+bool apply_ordering(hisland *island, int pos) {
+	if (! fill_bridges(island)) {
+		return false;
+	}
+	while (pos-- > 0) {
+		if (! reorder_bridges(island)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/** State of a pseudo-random generator (xorshift64*) with a settable seed. */
+typedef struct st_hrandom {
+	unsigned long long state;
+} hrandom;
+
+void init_random(hrandom *rnd, unsigned long long seed) {
+	/* the state of xorshift cannot be zero */
+	rnd->state = seed ? seed : 0x9E3779B97F4A7C15ULL;
+}
+
+unsigned long long next_random(hrandom *rnd) {
+	rnd->state ^= rnd->state >> 12;
+	rnd->state ^= rnd->state << 25;
+	rnd->state ^= rnd->state >> 27;
+	return rnd->state * 0x2545F4914F6CDD1DULL;
+}
+
+/** Returns a pseudo-random number between 0 (included) and 1 (excluded). */
+double random_unit(hrandom *rnd) {
+	return (next_random(rnd) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/** Returns a pseudo-random number between 0 and max - 1. */
+int random_below(hrandom *rnd, int max) {
+	return (int) (next_random(rnd) % (unsigned long long) max);
+}
+
+/** Result of the estimation of the size of the search tree. */
+typedef struct st_hestimate {
+	int probes;
+	double nodes, nodes_low, nodes_high;
+	double leaves, leaves_low, leaves_high;
+} hestimate;
+
+/** Makes one random descent through the tree of find_solutions_from_island
+ * choosing a random ordering of the bridges of each island (Knuth's method).
+ * The products of the branching factors found in each level estimate the
+ * number of nodes of that level, which are added to the estimated nodes.
+ * The estimated leaves are the nodes of the level after the last island.
+ * The nodes pruned by the checks of the board (as --lp) have no children,
+ * so the estimation is of the tree that the search with them explores. */
+void probe_search_tree(hboard *board, hrandom *rnd,
+		double *nodes, double *leaves) {
+	int idx, orderings;
+	double width = 1;
+	*nodes = 1;
+	*leaves = 0;
+	for (idx = 0; idx < board->num_islands; idx++) {
+		orderings = prune_node(board, idx) ? 0
+				: count_orderings(board->islands + idx);
+		if (orderings == 0) {
+			break;
+		}
+		width *= orderings;
+		*nodes += width;
+		apply_ordering(board->islands + idx,
+				random_below(rnd, orderings));
+	}
+	if (idx == board->num_islands) {
+		*leaves = width;
+	}
+	while (--idx > -1) {
+		clear_bridges(board->islands + idx);
+	}
+}
+
+/** Estimates the number of nodes and leaves of the search tree by the mean
+ * of the given number of random descents, with their 95% confidence intervals
+ * (lower bounds are never smaller than 1 node and 0 leaves). */
+void estimate_search_tree(hboard *board, hrandom *rnd, int probes,
+		hestimate *estimate) {
+	int i;
+	double nodes, leaves, sumnodes = 0, sumleaves = 0;
+	double sqnodes = 0, sqleaves = 0, margin;
+	for (i = 0; i < probes; i++) {
+		probe_search_tree(board, rnd, &nodes, &leaves);
+		sumnodes += nodes;
+		sqnodes += nodes * nodes;
+		sumleaves += leaves;
+		sqleaves += leaves * leaves;
+	}
+	estimate->probes = probes;
+	estimate->nodes = sumnodes / probes;
+	estimate->leaves = sumleaves / probes;
+	margin = sqnodes / probes - estimate->nodes * estimate->nodes;
+	margin = margin > 0 ? 1.96 * sqrt(margin / probes) : 0;
+	estimate->nodes_low = estimate->nodes - margin < 1
+			? 1 : estimate->nodes - margin;
+	estimate->nodes_high = estimate->nodes + margin;
+	margin = sqleaves / probes - estimate->leaves * estimate->leaves;
+	margin = margin > 0 ? 1.96 * sqrt(margin / probes) : 0;
+	estimate->leaves_low = estimate->leaves - margin < 0
+			? 0 : estimate->leaves - margin;
+	estimate->leaves_high = estimate->leaves + margin;
+}
+
+void print_estimate(hestimate *estimate) {
+	printf("Estimated nodes: %.0f (95%% confidence: %.0f - %.0f)\n",
+			estimate->nodes, estimate->nodes_low,
+			estimate->nodes_high);
+	printf("Estimated leaves: %.0f (95%% confidence: %.0f - %.0f)\n",
+			estimate->leaves, estimate->leaves_low,
+			estimate->leaves_high);
+	printf("Probes: %d\n", estimate->probes);
+}
+
+bool valid_visited_matrix_size(hboard *board) {
+	if (board->max_visited_size < board->num_islands) {
+		fprintf(stderr, "Maximum visited islands size too small: %d\n",
+				board->max_visited_size);
+		return false;
+	}
+	return true;
+}
+
+/** Prints the number of solutions found in the board. */
+void print_count(hboard *board) {
+	fprintf(board->out, "Solutions: %lld\n", board->num_solutions);
+}
+
+/** Prints the counters of the search of the board. */
+void print_stats(hboard *board) {
+	fprintf(stderr, "Nodes: %lld\n", board->stats.nodes);
+	fprintf(stderr, "Flow checks: %lld\n", board->stats.flow_checks);
+	fprintf(stderr, "Flow prunes: %lld\n", board->stats.flow_prunes);
+	fprintf(stderr, "Flow augmentations: %lld\n",
+			board->stats.augmentations);
+	fprintf(stderr, "Implication checks: %lld\n",
+			board->stats.implication_checks);
+	fprintf(stderr, "Implication prunes: %lld\n",
+			board->stats.implication_prunes);
+	fprintf(stderr, "Implied literals: %lld\n", board->stats.implied);
+	fprintf(stderr, "Skeletons: %lld\n", board->stats.skeletons);
+	fprintf(stderr, "Cut checks: %lld\n", board->stats.cut_checks);
+	fprintf(stderr, "Cut prunes: %lld\n", board->stats.cut_prunes);
+	fprintf(stderr, "Forced bridges: %lld\n",
+			board->stats.forced_bridges);
+	fprintf(stderr, "LP checks: %lld\n", board->stats.lp_checks);
+	fprintf(stderr, "LP prunes: %lld\n", board->stats.lp_prunes);
+	fprintf(stderr, "LP fixed connections: %lld\n",
+			board->stats.lp_fixed);
+	fprintf(stderr, "LP fixing prunes: %lld\n",
+			board->stats.lp_fix_prunes);
+	fprintf(stderr, "LP warm starts: %lld\n", board->stats.lp_warm);
+	fprintf(stderr, "LP pivots: %lld\n", board->stats.lp_pivots);
+	fprintf(stderr, "LP time: %.3f s\n", board->stats.lp_nanos / 1e9);
+	fprintf(stderr, "Restarts: %lld\n", board->stats.restarts);
+	fprintf(stderr, "Local steps: %lld\n", board->stats.local_steps);
+	fprintf(stderr, "Half states: %lld top, %lld bottom\n",
+			board->stats.top_states, board->stats.bottom_states);
+	fprintf(stderr, "Warm solutions: %lld\n",
+			board->stats.warm_solutions);
+}
+
+/** Prints the empty board and then all the solutions found,
+ * or only the number of solutions if the board is only counting them. */
+bool solve_board(hboard *board) {
+	if (! board->count_only) {
+		print_board(board);
+	}
+	if (board->num_islands) {
+		if (! valid_visited_matrix_size(board)) {
+			return false;
+		}
+		find_solutions_from_island(board, 0);
+	}
+	if (board->count_only) {
+		print_count(board);
+	}
+	return true;
+}
+
+/** Prints the empty board and then the solutions found up to the given
+ * maximum (or only their number if the board is only counting them),
+ * requesting the solutions one by one to an iterator. */
+bool solve_board_up_to(hboard *board, hstorage *storage, long long limit) {
+	hiterator iterator;
+	if (! board->count_only) {
+		print_board(board);
+	}
+	if (board->num_islands) {
+		if (! valid_visited_matrix_size(board) || ! init_iterator(
+				&iterator, board, storage->startedpath,
+				MAX_ISLANDS, storage->solutionbridges,
+				MAX_CONNECTIONS)) {
+			return false;
+		}
+		while (board->num_solutions < limit
+				&& next_solution(&iterator) != NULL) {
+			emit_solution(board);
+		}
+	}
+	if (board->count_only) {
+		print_count(board);
+	}
+	return true;
+}
+
+/** State of the two-phase search: first it decides which connections have
+ * bridges (one bridge each), checking the crossings and the connectivity,
+ * and then it decides which of those connections have a second bridge.
+ * For each island it keeps the connections with one bridge (present) and
+ * the connections not decided yet in the first phase (undecided) or with
+ * one bridge and not decided yet in the second phase (remaining). */
+typedef struct st_htopology {
+	hboard *board;
+	int *present, *undecided, *remaining, *used;
+	int num_used;
+} htopology;
+
+/** Returns true if the island can still build its pending bridges with its
+ * present connections (a second bridge each) and its undecided ones. */
+bool topology_feasible(htopology *topo, int i) {
+	return topo->board->islands[i].pendbridges
+			<= topo->present[i] + MAX_CONNECTION_BRIDGES
+			* topo->undecided[i];
+}
+
+/** Adds the second bridges of the used connections from the given position,
+ * emitting each solution. The remaining connections of each island must be
+ * enough to build its pending bridges. */
+void find_multiplicities(htopology *topo, int k) {
+	hboard *board = topo->board;
+	hconnection *conn;
+	int a, b;
+	if (k >= topo->num_used) {
+		emit_solution(board);
+		return;
+	}
+	conn = board->connections + topo->used[k];
+	a = connection_end(board, conn, true);
+	b = connection_end(board, conn, false);
+	topo->remaining[a]--;
+	topo->remaining[b]--;
+	if (add_bridge(conn)) {
+		if (board->islands[a].pendbridges <= topo->remaining[a]
+				&& board->islands[b].pendbridges
+				<= topo->remaining[b]) {
+			find_multiplicities(topo, k + 1);
+		}
+		del_bridge(conn);
+	}
+	if (board->islands[a].pendbridges <= topo->remaining[a]
+			&& board->islands[b].pendbridges
+			<= topo->remaining[b]) {
+		find_multiplicities(topo, k + 1);
+	}
+	topo->remaining[a]++;
+	topo->remaining[b]++;
+}
+
+/** Solves the multiplicities of a connected skeleton of present connections,
+ * adding their second bridges where the islands still need them. */
+void solve_multiplicities(htopology *topo) {
+	hboard *board = topo->board;
+	int i, c;
+	topo->num_used = 0;
+	for (i = 0; i < board->num_islands; i++) {
+		topo->remaining[i] = topo->present[i];
+		if (board->islands[i].pendbridges > topo->remaining[i]) {
+			return;
+		}
+	}
+	for (c = 0; c < board->num_connections; c++) {
+		if (board->connections[c].bridges) {
+			topo->used[topo->num_used++] = c;
+		}
+	}
+	board->stats.skeletons++;
+	find_multiplicities(topo, 0);
+}
+
+/** Decides the presence of bridges in the connections from the given index,
+ * first with bridges (if they do not cross others) and then without them. */
+void find_topologies(htopology *topo, int c) {
+	hboard *board = topo->board;
+	hconnection *conn;
+	int a, b;
+	board->stats.nodes++;
+	if (c >= board->num_connections) {
+		if (check_connected_solution(board)) {
+			solve_multiplicities(topo);
+		}
+		return;
+	}
+	conn = board->connections + c;
+	a = connection_end(board, conn, true);
+	b = connection_end(board, conn, false);
+	topo->undecided[a]--;
+	topo->undecided[b]--;
+	if (add_bridge(conn)) {
+		topo->present[a]++;
+		topo->present[b]++;
+		if (topology_feasible(topo, a) && topology_feasible(topo, b)) {
+			find_topologies(topo, c + 1);
+		}
+		topo->present[a]--;
+		topo->present[b]--;
+		del_bridge(conn);
+	}
+	if (topology_feasible(topo, a) && topology_feasible(topo, b)) {
+		find_topologies(topo, c + 1);
+	}
+	topo->undecided[a]++;
+	topo->undecided[b]++;
+}
+
+/** Prints the empty board and then all the solutions found by the two-phase
+ * search, or only the number of solutions if the board is only counting. */
+bool solve_board_topology(hboard *board) {
+	htopology topo;
+	int n = board->num_islands, i, dir;
+	bool solved = true;
+	if (! board->count_only) {
+		print_board(board);
+	}
+	if (n && ! valid_visited_matrix_size(board)) {
+		return false;
+	}
+	topo.board = board;
+	topo.present = calloc(n + 1, sizeof(int));
+	topo.undecided = calloc(n + 1, sizeof(int));
+	topo.remaining = calloc(n + 1, sizeof(int));
+	topo.used = malloc((board->num_connections + 1) * sizeof(int));
+	if (topo.present == NULL || topo.undecided == NULL
+			|| topo.remaining == NULL || topo.used == NULL) {
+		fprintf(stderr, "Not enough memory for the topologies\n");
+		solved = false;
+	} else if (n) {
+		for (i = 0; i < n; i++) {
+			for (dir = 0; dir < DIRECTIONS; dir++) {
+				if (board->islands[i].connections[dir]
+						!= board->out_connection) {
+					topo.undecided[i]++;
+				}
+			}
+		}
+		find_topologies(&topo, 0);
+	}
+	free(topo.present);
+	free(topo.undecided);
+	free(topo.remaining);
+	free(topo.used);
+	if (solved && board->count_only) {
+		print_count(board);
+	}
+	return solved;
+}
+
+/** State of the search of one solution with restarts: the search tries the
+ * orderings of bridges of each island in a random order and starts again
+ * with other random orders after a number of nodes given by the Luby
+ * sequence (1 1 2 1 1 2 4 ...) multiplied by a base, so it does not stay
+ * in a big subtree without solutions. The last ordering tried in each island
+ * (its phase) can be kept to try it first after the restart. */
+typedef struct st_hrestarts {
+	hrandom rnd;
+	long long nodes, budget;
+	bool keep_phases;
+	int *phases;
+} hrestarts;
+
+/** Returns the element of the Luby sequence at the given position (from 1). */
+long long luby(long long i) {
+	long long power = 2;
+	while (power - 1 < i) {
+		power *= 2;
+	}
+	if (power - 1 == i) {
+		return power / 2;
+	}
+	return luby(i - power / 2 + 1);
+}
+
+/** Finds one solution from the island with the given index trying its
+ * orderings of bridges in a random order, counting the work of each island
+ * if the board has a profile. Returns SEARCH_SOLUTION leaving the bridges of
+ * the solution in the board, SEARCH_PAUSED if the budget of nodes is
+ * consumed, or SEARCH_FINISHED if there is no solution. */
+search_status find_one_from_island(hboard *board, hrestarts *restarts,
+		int idx) {
+	hprofile *profile = board->profile;
+	hisland *island;
+	int orders[MAX_ORDERINGS], num = 0, k, j, swap;
+	long long start = 0;
+	search_status status = SEARCH_FINISHED;
+	if (idx >= board->num_islands) {
+		return check_connected_solution(board) ? SEARCH_SOLUTION
+				: SEARCH_FINISHED;
+	}
+	if (restarts->nodes++ >= restarts->budget) {
+		return SEARCH_PAUSED;
+	}
+	if (profile != NULL) {
+		profile->visits[idx]++;
+		start = monotonic_nanos();
+	}
+	island = board->islands + idx;
+	if (! prune_node(board, idx)) {
+		num = count_orderings(island);
+		if (profile != NULL && num == 0) {
+			profile->fill_failures[idx]++;
+		}
+	}
+	for (k = 0; k < num; k++) {
+		j = random_below(&restarts->rnd, k + 1);
+		if (j != k) {
+			orders[k] = orders[j];
+		}
+		orders[j] = k;
+	}
+	for (k = 1; restarts->keep_phases && k < num; k++) {
+		if (orders[k] == restarts->phases[idx]) {
+			swap = orders[0];
+			orders[0] = orders[k];
+			orders[k] = swap;
+		}
+	}
+	for (k = 0; k < num; k++) {
+		if (profile != NULL && k > 0) {
+			profile->reorders[idx]++;
+		}
+		apply_ordering(island, orders[k]);
+		restarts->phases[idx] = orders[k];
+		status = find_one_from_island(board, restarts, idx + 1);
+		if (status == SEARCH_SOLUTION) {
+			break;
+		}
+		clear_bridges(island);
+		if (status == SEARCH_PAUSED) {
+			break;
+		}
+	}
+	if (profile != NULL) {
+		profile->nanos[idx] += monotonic_nanos() - start;
+	}
+	return status;
+}
+
+/** Finds one solution restarting the search after the given base of nodes
+ * multiplied by the Luby sequence. Returns SEARCH_SOLUTION leaving the bridges
+ * of the solution in the board or SEARCH_FINISHED if there is no solution. */
+search_status find_one_with_restarts(hboard *board, hrestarts *restarts,
+		long long base) {
+	search_status status;
+	long long run = 0;
+	do {
+		if (run++ > 0) {
+			board->stats.restarts++;
+		}
+		restarts->nodes = 0;
+		restarts->budget = luby(run) * base;
+		status = find_one_from_island(board, restarts, 0);
+	} while (status == SEARCH_PAUSED);
+	return status;
+}
+
+/** Prints the empty board and then one solution (or only the number of
+ * solutions found, 0 or 1, if the board is only counting them), searching
+ * with random orders and restarts after the given base of nodes. */
+bool solve_board_find_one(hboard *board, unsigned long long seed,
+		long long base, bool keep_phases) {
+	hrestarts restarts;
+	search_status status = SEARCH_FINISHED;
+	if (! board->count_only) {
+		print_board(board);
+	}
+	if (board->num_islands) {
+		if (! valid_visited_matrix_size(board)) {
+			return false;
+		}
+		if ((restarts.phases = malloc(board->num_islands
+				* sizeof(int))) == NULL) {
+			fprintf(stderr, "Not enough memory for the phases\n");
+			return false;
+		}
+		memset(restarts.phases, -1, board->num_islands * sizeof(int));
+		init_random(&restarts.rnd, seed);
+		restarts.keep_phases = keep_phases;
+		status = find_one_with_restarts(board, &restarts, base);
+		free(restarts.phases);
+	}
+	if (status == SEARCH_SOLUTION) {
+		emit_solution(board);
+	}
+	if (board->count_only) {
+		print_count(board);
+	}
+	return true;
+}
+
+/** Deletes the cross elements of the given connection and their pairs in
+ * the connections crossing it, keeping them to be reused by next_crosselem. */
+void unlink_crosses(hboard *board, hconnection *connection) {
+	hcrosselem *cross, *next, **ppair, *pair;
+	for (cross = connection->firstcross; cross != NULL; cross = next) {
+		next = cross->nextcross;
+		ppair = &(bridges_owner(cross->pbridges)->firstcross);
+		while ((pair = *ppair) != NULL
+				&& pair->pbridges != &(connection->bridges)) {
+			ppair = &(pair->nextcross);
+		}
+		if (pair != NULL) {
+			*ppair = pair->nextcross;
+			pair->nextcross = board->freecrosselems;
+			board->freecrosselems = pair;
+		}
+		cross->nextcross = board->freecrosselems;
+		board->freecrosselems = cross;
+	}
+	connection->firstcross = NULL;
+}
+
+/** Deletes the connection of the island in the given direction with its
+ * bridges and cross elements, moving the last connection to its place so
+ * the array has no holes (updating the islands and the cross elements that
+ * point to the moved connection). */
+void drop_connection(hboard *board, hisland *island, direction dir) {
+	hconnection *connection = island->connections[dir];
+	hconnection *last = board->connections + --board->num_connections;
+	hisland *ends[2], *other = island->islands[dir];
+	hcrosselem *cross, *pair;
+	int i, j;
+	while (del_bridge(connection));
+	unlink_crosses(board, connection);
+	island->islands[dir] = board->out_island;
+	island->connections[dir] = board->out_connection;
+	other->islands[DIRECTIONS - 1 - dir] = board->out_island;
+	other->connections[DIRECTIONS - 1 - dir] = board->out_connection;
+	if (connection == last) {
+		return;
+	}
+	*connection = *last;
+	ends[0] = pending_island(last->ppendbridges1);
+	ends[1] = pending_island(last->ppendbridges2);
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < DIRECTIONS; j++) {
+			if (ends[i]->connections[j] == last) {
+				ends[i]->connections[j] = connection;
+			}
+		}
+	}
+	for (cross = connection->firstcross; cross != NULL;
+			cross = cross->nextcross) {
+		for (pair = bridges_owner(cross->pbridges)->firstcross;
+				pair != NULL; pair = pair->nextcross) {
+			if (pair->pbridges == &(last->bridges)) {
+				pair->pbridges = &(connection->bridges);
+			}
+		}
+	}
+}
+
+/** Moves the islands from the given index to the end by the given offset
+ * (1 to leave room for a new island at the index, or -1 to delete the island
+ * before it, which must not be linked to others), and updates the addresses
+ * of the moved islands in the other islands and in the connections. */
+void shift_islands(hboard *board, int pos, int offset) {
+	hisland *first = board->islands + pos, *island;
+	hconnection *conn;
+	int i, dir;
+	memmove(first + offset, first,
+			(board->num_islands - pos) * sizeof(hisland));
+	board->num_islands += offset;
+	for (i = 0; i < board->num_islands; i++) {
+		island = board->islands + i;
+		for (dir = 0; dir < DIRECTIONS; dir++) {
+			if (island->islands[dir] != board->out_island
+					&& island->islands[dir] >= first) {
+				island->islands[dir] += offset;
+			}
+		}
+	}
+	for (i = 0; i < board->num_connections; i++) {
+		conn = board->connections + i;
+		island = pending_island(conn->ppendbridges1);
+		if (island >= first) {
+			conn->ppendbridges1 = &((island + offset)->pendbridges);
+		}
+		island = pending_island(conn->ppendbridges2);
+		if (island >= first) {
+			conn->ppendbridges2 = &((island + offset)->pendbridges);
+		}
+	}
+}
+
+/** Returns the index of the first island of the board that is not before
+ * the given position (by rows and then by columns). */
+int find_island_position(hboard *board, int row, int col) {
+	hisland *island;
+	int low = 0, high = board->num_islands, mid;
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		island = board->islands + mid;
+		if (island->row < row || (island->row == row
+				&& island->col < col)) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+/** Inserts a new island at the given index of the board, splitting the
+ * connections that passed through its position, and creates its connections
+ * with the cross elements of their row or column (instead of building again
+ * all the connections of the board). */
+bool insert_island(hboard *board, int pos, int row, int col,
+		int expectbridges) {
+	hisland *island, *left, *right, *up, *down;
+	int i;
+	if (board->num_islands >= board->max_islands) {
+		fprintf(stderr, "Maximum of islands reached: %d\n",
+				board->num_islands);
+		return false;
+	}
+	if (board->num_connections + 2 > board->max_connections) {
+		fprintf(stderr, "Maximum of connections reached: %d\n",
+				board->num_connections);
+		return false;
+	}
+	shift_islands(board, pos, 1);
+	island = board->islands + pos;
+	island->expectbridges = expectbridges;
+	island->pendbridges = expectbridges;
+	island->row = row;
+	island->col = col;
+	for (i = 0; i < DIRECTIONS; i++) {
+		island->islands[i] = board->out_island;
+		island->connections[i] = board->out_connection;
+	}
+	left = pos > 0 && island[-1].row == row ? island - 1
+			: board->out_island;
+	right = pos + 1 < board->num_islands && island[1].row == row
+			? island + 1 : board->out_island;
+	up = find_from_island(board, pos, UP);
+	down = up != board->out_island ? up->islands[DOWN] : board->out_island;
+	for (i = pos + 1; up == board->out_island
+			&& i < board->num_islands; i++) {
+		if (board->islands[i].col == col) {
+			down = board->islands + i;
+			break;
+		}
+	}
+	if (left != board->out_island && right != board->out_island) {
+		drop_connection(board, left, RIGHT);
+	}
+	if (up != board->out_island && down != board->out_island) {
+		drop_connection(board, up, DOWN);
+	}
+	if (left != board->out_island && (new_connection(board, left,
+			island, RIGHT) == NULL
+			|| ! fill_row_crosses(board, left, island))) {
+		return false;
+	}
+	if (right != board->out_island && (new_connection(board, island,
+			right, RIGHT) == NULL
+			|| ! fill_row_crosses(board, island, right))) {
+		return false;
+	}
+	if (up != board->out_island && (new_connection(board, up,
+			island, DOWN) == NULL
+			|| ! fill_crosses(board, up, island))) {
+		return false;
+	}
+	if (down != board->out_island && (new_connection(board, island,
+			down, DOWN) == NULL
+			|| ! fill_crosses(board, island, down))) {
+		return false;
+	}
+	if (board->rows <= row) {
+		board->rows = row + 1;
+	}
+	if (board->cols <= col) {
+		board->cols = col + 1;
+	}
+	board->max_bridges += expectbridges;
+	return true;
+}
+
+/** Removes the island with the given index from the board, deleting its
+ * connections and joining the islands at both sides of it in its row and in
+ * its column with new connections and their cross elements. */
+bool remove_island(hboard *board, int pos) {
+	hisland *island = board->islands + pos, *next[DIRECTIONS];
+	int dir;
+	for (dir = 0; dir < DIRECTIONS; dir++) {
+		next[dir] = island->islands[dir];
+		if (next[dir] != board->out_island) {
+			drop_connection(board, island, dir);
+		}
+	}
+	if (next[LEFT] != board->out_island && next[RIGHT] != board->out_island
+			&& (new_connection(board, next[LEFT], next[RIGHT],
+			RIGHT) == NULL || ! fill_row_crosses(board, next[LEFT],
+			next[RIGHT]))) {
+		return false;
+	}
+	if (next[UP] != board->out_island && next[DOWN] != board->out_island
+			&& (new_connection(board, next[UP], next[DOWN],
+			DOWN) == NULL || ! fill_crosses(board, next[UP],
+			next[DOWN]))) {
+		return false;
+	}
+	board->max_bridges -= island->expectbridges;
+	shift_islands(board, pos + 1, -1);
+	return true;
+}
+
+/** Changes the expected bridges of the island at the given position of the
+ * board, adding a new island if there is none there or removing it if the
+ * bridges are 0. Only the connections around the position are changed, and
+ * the bridges of the others are kept (the bridges of the changed island are
+ * deleted). */
+bool edit_island(hboard *board, int row, int col, int expectbridges) {
+	hisland *island;
+	int pos, dir;
+	if (row < 0 || col < 0 || row == INT_MAX || col == INT_MAX) {
+		fprintf(stderr, "Invalid position: %d,%d\n", row, col);
+		return false;
+	}
+	if (expectbridges < 0 || expectbridges > MAX_EXPECTED_BRIDGES) {
+		fprintf(stderr, "Bad number of bridges: %d\n", expectbridges);
+		return false;
+	}
+	pos = find_island_position(board, row, col);
+	island = board->islands + pos;
+	if (pos == board->num_islands || island->row != row
+			|| island->col != col) {
+		if (! expectbridges) {
+			fprintf(stderr, "No island to remove: %d,%d\n",
+					row, col);
+			return false;
+		}
+		return insert_island(board, pos, row, col, expectbridges);
+	}
+	if (! expectbridges) {
+		return remove_island(board, pos);
+	}
+	if (expectbridges == island->expectbridges) {
+		return true;
+	}
+	for (dir = 0; dir < DIRECTIONS; dir++) {
+		while (del_bridge(island->connections[dir]));
+	}
+	board->max_bridges += expectbridges - island->expectbridges;
+	island->expectbridges = expectbridges;
+	island->pendbridges = expectbridges;
+	return true;
+}
+
+/** Returns true if the bridges in the board are a solution: all the islands
+ * have their expected bridges and they are connected. */
+bool valid_board_solution(hboard *board) {
+	int i;
+	for (i = 0; i < board->num_islands; i++) {
+		if (board->islands[i].pendbridges) {
+			return false;
+		}
+	}
+	return check_connected_solution(board);
+}
+
+/** Adds the given bridges of the RIGHT and DOWN connections of the island
+ * that can be added. */
+void add_island_bridges(hisland *island, const char *bridges) {
+	int k;
+	for (k = 0; k < bridges[0]; k++) {
+		add_bridge(island->connections[RIGHT]);
+	}
+	for (k = 0; k < bridges[1]; k++) {
+		add_bridge(island->connections[DOWN]);
+	}
+}
+
+/** Builds the board again in arrays with room for twice its islands, with
+ * the same islands, bridges and options, and frees the old arrays (the board
+ * is not changed if there is no memory for the new ones). Only the boards
+ * whose arrays were allocated by init_board_arrays can grow. */
+bool grow_board_arrays(hboard *board) {
+	hboard old = *board;
+	hsparse *islands = malloc((old.num_islands + 1) * sizeof(hsparse));
+	char *bridges = malloc(2 * old.num_islands + 1);
+	hisland *island;
+	int i, max = old.max_islands > 128 ? 2 * old.max_islands : 256;
+	bool ok;
+	if (islands == NULL || bridges == NULL) {
+		fprintf(stderr, "Not enough memory for %d islands\n", max);
+		free(islands);
+		free(bridges);
+		return false;
+	}
+	for (i = 0; i < old.num_islands; i++) {
+		island = old.islands + i;
+		islands[i].row = island->row;
+		islands[i].col = island->col;
+		islands[i].bridges = island->expectbridges;
+		bridges[2 * i] = island->connections[RIGHT]->bridges;
+		bridges[2 * i + 1] = island->connections[DOWN]->bridges;
+	}
+	if ((ok = init_board_arrays(board, max, 2 * max, old.num_crosselems,
+			max))) {
+		board->out = old.out;
+		board->format = old.format;
+		board->count_only = old.count_only;
+		board->trace = old.trace;
+		board->counters = old.counters;
+		board->stats = old.stats;
+		for (i = 0; ok && i < old.num_islands; i++) {
+			ok = add_island(board, islands[i].row, islands[i].col,
+					islands[i].bridges);
+		}
+		for (i = 0; ok && i < old.num_islands; i++) {
+			add_island_bridges(board->islands + i, bridges + 2 * i);
+		}
+		free_board_arrays(&old);
+	}
+	free(islands);
+	free(bridges);
+	return ok;
+}
+
+/** Saves the bridges of the board (two per island, in its RIGHT and DOWN
+ * connections) and in the phases the position of the ordering of each island
+ * that adds them, or -1 if no ordering adds them (as in the edited islands),
+ * deleting them. The bridges are added again from the first island so each
+ * one has the pending bridges that the search sees. */
+void seed_phases(hboard *board, int *phases, char *bridges) {
+	hisland *island;
+	hconnection *right, *down;
+	int i, k;
+	bool added;
+	for (i = 0; i < board->num_islands; i++) {
+		island = board->islands + i;
+		bridges[2 * i] = island->connections[RIGHT]->bridges;
+		bridges[2 * i + 1] = island->connections[DOWN]->bridges;
+	}
+	for (i = 0; i < board->num_islands; i++) {
+		clear_bridges(board->islands + i);
+	}
+	for (i = 0; i < board->num_islands; i++) {
+		island = board->islands + i;
+		right = island->connections[RIGHT];
+		down = island->connections[DOWN];
+		phases[i] = -1;
+		for (k = 0, added = fill_bridges(island); added; k++) {
+			if (right->bridges == bridges[2 * i] && down->bridges
+					== bridges[2 * i + 1]) {
+				phases[i] = k;
+				break;
+			}
+			added = reorder_bridges(island);
+		}
+		if (phases[i] < 0) {
+			add_island_bridges(island, bridges + 2 * i);
+		}
+	}
+	for (i = 0; i < board->num_islands; i++) {
+		clear_bridges(board->islands + i);
+	}
+}
+
+/** Finds one solution of the board starting from the bridges in the board
+ * (if they are already a solution it is not searched, and otherwise each
+ * island tries first the ordering of its bridges in them), and prints it or
+ * its number of solutions. The solution is left in the board, or the previous
+ * bridges if there is no solution, to start from them after the next edit. */
+bool solve_board_warm(hboard *board, hrestarts *restarts, char *bridges,
+		long long base) {
+	search_status status = SEARCH_FINISHED;
+	int i;
+	board->num_solutions = 0;
+	if (! valid_visited_matrix_size(board)) {
+		return false;
+	}
+	if (board->num_islands && valid_board_solution(board)) {
+		board->stats.warm_solutions++;
+		status = SEARCH_SOLUTION;
+	} else if (board->num_islands) {
+		seed_phases(board, restarts->phases, bridges);
+		status = find_one_with_restarts(board, restarts, base);
+		for (i = 0; status != SEARCH_SOLUTION
+				&& i < board->num_islands; i++) {
+			add_island_bridges(board->islands + i, bridges + 2 * i);
+		}
+	}
+	if (status == SEARCH_SOLUTION) {
+		emit_solution(board);
+	}
+	if (board->count_only) {
+		print_count(board);
+	} else if (status != SEARCH_SOLUTION) {
+		fprintf(board->out, "No solution\n");
+	}
+	return true;
+}
+
+/** Grows the arrays of the board and the phases and bridges saved for its
+ * islands when another island may be added by an edit. */
+bool grow_edit_arrays(hboard *board, hrestarts *restarts, char **saved) {
+	int *phases;
+	char *grown;
+	if (! grow_board_arrays(board)) {
+		return false;
+	}
+	phases = realloc(restarts->phases, (board->max_islands + 1)
+			* sizeof(int));
+	if (phases != NULL) {
+		restarts->phases = phases;
+	}
+	grown = realloc(*saved, 2 * board->max_islands + 1);
+	if (grown != NULL) {
+		*saved = grown;
+	}
+	if (phases == NULL || grown == NULL) {
+		fprintf(stderr, "Not enough memory for the phases\n");
+		return false;
+	}
+	return true;
+}
+
+/** Prints the empty board and one solution, and then for each line "row col
+ * bridges" of the file of edits changes the island at that position as
+ * edit_island does and prints a line "Edit N: row col bridges" and one
+ * solution of the changed board, starting from the previous solution. */
+bool solve_edits(hboard *board, const char *path, unsigned long long seed,
+		long long base) {
+	hrestarts restarts;
+	FILE *file;
+	char *saved;
+	int row, col, bridges, read = EOF, num = 0;
+	bool ok = true;
+	if ((file = fopen(path, "r")) == NULL) {
+		perror(path);
+		return false;
+	}
+	restarts.phases = malloc((board->max_islands + 1) * sizeof(int));
+	saved = malloc(2 * board->max_islands + 1);
+	if (restarts.phases == NULL || saved == NULL) {
+		fprintf(stderr, "Not enough memory for the phases\n");
+		free(restarts.phases);
+		free(saved);
+		fclose(file);
+		return false;
+	}
+	init_random(&restarts.rnd, seed);
+	restarts.keep_phases = true;
+	set_output_format(board, FORMAT_BOARD);
+	if (! board->count_only) {
+		print_board(board);
+	}
+	ok = solve_board_warm(board, &restarts, saved, base);
+	while (ok && (read = fscanf(file, "%d %d %d", &row, &col,
+			&bridges)) == 3) {
+		if (board->grow_arrays && board->num_islands
+				== board->max_islands && ! grow_edit_arrays(
+				board, &restarts, &saved)) {
+			ok = false;
+			break;
+		}
+		if (! edit_island(board, row, col, bridges)) {
+			fprintf(stderr, "Bad edit: %d\n", num + 1);
+			ok = false;
+			break;
+		}
+		fprintf(board->out, "Edit %d: %d %d %d\n", ++num, row, col,
+				bridges);
+		ok = solve_board_warm(board, &restarts, saved, base);
+	}
+	if (ok && read != EOF) {
+		fprintf(stderr, "Bad edit: %d\n", num + 1);
+		ok = false;
+	}
+	free(restarts.phases);
+	free(saved);
+	fclose(file);
+	return ok;
+}
+
+/** Writes the puzzle of the board in one line, with slashes between rows. */
+void write_puzzle(hboard *board, FILE *out) {
+	int i, j, index = 0;
+	hisland *island;
+	for (i = 0; i < board->rows; i++) {
+		if (i > 0) {
+			fputc('/', out);
+		}
+		for (j = 0; j < board->cols; j++) {
+			island = board->islands + index;
+			if (index < board->num_islands && island->row == i
+					&& island->col == j) {
+				fputc('0' + island->expectbridges, out);
+				index++;
+			} else {
+				fputc('0', out);
+			}
+		}
+	}
+	fputc('\n', out);
+}
+
+/** Writes a job file with the puzzle and the bridges added in the RIGHT and
+ * DOWN directions of the islands before the given index, so the job can be
+ * solved independently from the other jobs continuing from that island. */
+bool write_job(hboard *board, int depth, const char *path) {
+	FILE *file;
+	int idx;
+	hisland *island;
+	if ((file = fopen(path, "w")) == NULL) {
+		perror(path);
+		return false;
+	}
+	fprintf(file, "hashi job\npuzzle ");
+	write_puzzle(board, file);
+	fprintf(file, "depth %d\nbridges", depth);
+	for (idx = 0; idx < depth; idx++) {
+		island = board->islands + idx;
+		fprintf(file, " %d %d", island->connections[RIGHT]->bridges,
+				island->connections[DOWN]->bridges);
+	}
+	fprintf(file, "\n");
+	if (fclose(file) != 0) {
+		perror(path);
+		return false;
+	}
+	return true;
+}
+
+/** Writes one job for each partial solution with the islands before the given
+ * depth completed, found in the same way of find_solutions_from_island. */
+bool emit_jobs_from_island(hboard *board, int idx, int depth,
+		const char *dir, int *num_jobs) {
+	char path[FILENAME_MAX];
+	hisland *island;
+	if (idx >= depth || idx >= board->num_islands) {
+		if (snprintf(path, sizeof(path), "%s/job-%06d.txt",
+				dir, *num_jobs) >= (int) sizeof(path)) {
+			fprintf(stderr, "Too long directory: %s\n", dir);
+			return false;
+		}
+		(*num_jobs)++;
+		return write_job(board, idx, path);
+	}
+	island = board->islands + idx;
+	if (fill_bridges(island)) {
+		do {
+			if (! emit_jobs_from_island(board, idx + 1, depth,
+					dir, num_jobs)) {
+				clear_bridges(island);
+				return false;
+			}
+		} while (reorder_bridges(island));
+	}
+	return true;
+}
+
+/** Splits the search of the board in jobs written in the given directory. */
+bool emit_jobs(hboard *board, int depth, const char *dir) {
+	int num_jobs = 0;
+	if (! emit_jobs_from_island(board, 0, depth, dir, &num_jobs)) {
+		return false;
+	}
+	printf("Jobs: %d\n", num_jobs);
+	return true;
+}
+
+/** Reads a job file written by write_job and adds its bridges to the board,
+ * returning the index of the island where the search must continue or -1
+ * if the job is not valid. */
+int read_job(hboard *board, const char *path) {
+	FILE *file;
+	char *line = NULL;
+	size_t linesize = 0;
+	int depth = -1, idx, right, down;
+	hisland *island;
+	bool ok = false;
+	if ((file = fopen(path, "r")) == NULL) {
+		perror(path);
+		return -1;
+	}
+	if (getline(&line, &linesize, file) == -1
+			|| strcmp(line, "hashi job\n") != 0
+			|| getline(&line, &linesize, file) == -1
+			|| strncmp(line, "puzzle ", 7) != 0
+			|| ! read_islands_line(board, line + 7)
+			|| fscanf(file, "depth %d bridges", &depth) != 1
+			|| depth < 0 || depth > board->num_islands) {
+		fprintf(stderr, "Invalid job file: %s\n", path);
+		depth = -1;
+	}
+	for (idx = 0; depth > -1 && idx < depth; idx++) {
+		island = board->islands + idx;
+		if (fscanf(file, "%d %d", &right, &down) != 2) {
+			break;
+		}
+		while (right > 0 && add_bridge(island->connections[RIGHT])) {
+			right--;
+		}
+		while (down > 0 && add_bridge(island->connections[DOWN])) {
+			down--;
+		}
+		if (right || down || island->pendbridges) {
+			break;
+		}
+	}
+	if (depth > -1 && idx == depth) {
+		ok = true;
+	} else if (depth > -1) {
+		fprintf(stderr, "Invalid bridges in job file: %s\n", path);
+	}
+	free(line);
+	fclose(file);
+	return ok ? depth : -1;
+}
+
+/** Solves the job of the given file, printing its solutions or their number
+ * (but not the empty board, so the outputs of all jobs can be merged). */
+bool run_job(hboard *board, const char *path, output_format format) {
+	int depth;
+	if ((depth = read_job(board, path)) < 0) {
+		return false;
+	}
+	set_output_format(board, format);
+	if (board->num_islands) {
+		if (! valid_visited_matrix_size(board)) {
+			return false;
+		}
+		find_solutions_from_island(board, depth);
+	}
+	if (board->count_only) {
+		print_count(board);
+	}
+	return true;
+}
+
+/** Merges the outputs of the given jobs: their numbers of solutions are added
+ * and any other outputs (the solutions themselves) are concatenated. */
+bool merge_jobs(char **paths, int num_paths) {
+	FILE *file;
+	char buffer[BUFSIZ];
+	size_t length;
+	long long total = 0, count;
+	bool counted = false;
+	int i;
+	for (i = 0; i < num_paths; i++) {
+		if ((file = fopen(paths[i], "r")) == NULL) {
+			perror(paths[i]);
+			return false;
+		}
+		if (fscanf(file, "Solutions: %lld", &count) == 1) {
+			total += count;
+			counted = true;
+		} else {
+			rewind(file);
+			while ((length = fread(buffer, 1, sizeof(buffer), file))
+					> 0) {
+				fwrite(buffer, 1, length, stdout);
+			}
+		}
+		fclose(file);
+	}
+	if (counted) {
+		printf("Solutions: %lld\n", total);
+	}
+	return true;
+}
+
+/** Edge of a node of a decision diagram: the bridges added to the RIGHT and
+ * DOWN connections of the island of the node and the node of the next island.
+ * Only edges to nodes with solutions are kept (zero-suppressed). */
+typedef struct st_hddedge {
+	char right, down;
+	int child;
+} hddedge;
+
+/** Node of a decision diagram for the island with the index of its level,
+ * with its edges and the number of solutions that start from it. */
+typedef struct st_hddnode {
+	int level, first_edge, num_edges;
+	double count;
+} hddnode;
+
+/** Entry of the hash tables of the diagram: a node with the hash of its key. */
+typedef struct st_hddentry {
+	unsigned long hash;
+	int node, keyoffset, keylength;
+} hddentry;
+
+/** Decision diagram of all the solutions of a board, compiled by the search
+ * of find_solutions_from_island remembering the node of each state reached,
+ * so the equal subproblems are solved only once. The state before an island
+ * only depends on the islands reached by the previous connections (the
+ * frontier): their pending bridges, if their UP connections have bridges
+ * (which can cross the next connections) and which of them are connected.
+ * Nodes with the same level and edges are also shared (unique table).
+ * The node 0 is the terminal without solutions and the node 1 the terminal
+ * with one solution. */
+typedef struct st_hdiagram {
+	hddnode *nodes;
+	int num_nodes, max_nodes;
+	hddedge *edges;
+	int num_edges, max_edges;
+	hddentry *states, *uniques;
+	int num_states, num_uniques, max_entries;
+	char *keys;
+	int num_keys, max_keys;
+	int root;
+} hdiagram;
+
+/** Hashes the given bytes continuing from the given hash (FNV-1a). */
+unsigned long hash_bytes(const char *bytes, int length, unsigned long hash) {
+	while (length-- > 0) {
+		hash = (hash ^ (unsigned char) *bytes++) * HASH_PRIME;
+	}
+	return hash;
+}
+
+/** Returns the position of the entry with the given hash and key in the table
+ * or the free position where it must be inserted. */
+int find_dd_entry(hdiagram *dd, hddentry *table, unsigned long hash,
+		const char *key, int keylength, bool unique) {
+	int pos = (int) (hash & (dd->max_entries - 1));
+	hddentry *entry;
+	hddnode *node, *other;
+	for (;; pos = (pos + 1) & (dd->max_entries - 1)) {
+		entry = table + pos;
+		if (entry->node < 0) {
+			return pos;
+		}
+		if (entry->hash != hash) {
+			continue;
+		}
+		if (unique) {
+			node = (hddnode *) key;
+			other = dd->nodes + entry->node;
+			if (node->level == other->level
+					&& node->num_edges == other->num_edges
+					&& memcmp(dd->edges + node->first_edge,
+						dd->edges + other->first_edge,
+						node->num_edges
+						* sizeof(hddedge)) == 0) {
+				return pos;
+			}
+		} else if (entry->keylength == keylength && memcmp(dd->keys
+				+ entry->keyoffset, key, keylength) == 0) {
+			return pos;
+		}
+	}
+}
+
+/** Doubles the size of the hash tables when they are half full. */
+bool grow_dd_tables(hdiagram *dd) {
+	hddentry *states, *uniques, *oldstates = dd->states;
+	hddentry *olduniques = dd->uniques;
+	int i, oldmax = dd->max_entries;
+	if (2 * (dd->num_states + 1) < dd->max_entries
+			&& 2 * (dd->num_uniques + 1) < dd->max_entries) {
+		return true;
+	}
+	dd->max_entries = oldmax ? oldmax * 2 : 1024;
+	states = malloc(dd->max_entries * sizeof(hddentry));
+	uniques = malloc(dd->max_entries * sizeof(hddentry));
+	if (states == NULL || uniques == NULL) {
+		fprintf(stderr, "Not enough memory for %d states\n",
+				dd->max_entries);
+		free(states);
+		free(uniques);
+		return false;
+	}
+	for (i = 0; i < dd->max_entries; i++) {
+		states[i].node = uniques[i].node = -1;
+	}
+	dd->states = states;
+	dd->uniques = uniques;
+	for (i = 0; i < oldmax; i++) {
+		if (oldstates[i].node > -1) {
+			states[find_dd_entry(dd, states, oldstates[i].hash,
+				dd->keys + oldstates[i].keyoffset,
+				oldstates[i].keylength, false)] = oldstates[i];
+		}
+		if (olduniques[i].node > -1) {
+			uniques[find_dd_entry(dd, uniques, olduniques[i].hash,
+				(char *) (dd->nodes + olduniques[i].node), 0,
+				true)] = olduniques[i];
+		}
+	}
+	free(oldstates);
+	free(olduniques);
+	return true;
+}
+
+/** Finds the representative island of the group of the given island. */
+int find_group(int *groups, int idx) {
+	while (groups[idx] != idx) {
+		idx = groups[idx] = groups[groups[idx]];
+	}
+	return idx;
+}
+
+/** Joins the groups of islands connected by bridges in the RIGHT and DOWN
+ * connections of the islands before the given index (the decided ones). */
+void group_decided_islands(hboard *board, int idx, int *groups) {
+	int i, dir;
+	hisland *island;
+	for (i = 0; i < board->num_islands; i++) {
+		groups[i] = i;
+	}
+	for (i = 0; i < idx; i++) {
+		island = board->islands + i;
+		for (dir = RIGHT; dir <= DOWN; dir++) {
+			if (island->connections[dir]->bridges) {
+				groups[find_group(groups, i)] = find_group(
+					groups, island_index(board,
+						island->islands[dir]));
+			}
+		}
+	}
+}
+
+/** Appends to the keys of the diagram the state of the board before the island
+ * with the given index, returning 0 if it cannot lead to a connected solution
+ * (a group of islands is already closed without the rest), 1 if it can and
+ * -1 on errors (when the groups do not fit in the bytes of the key). */
+int append_dd_state(hdiagram *dd, hboard *board, int idx, int *groups,
+		int *labels) {
+	int i, j, up, group, num_labels = 0, closed = 0;
+	hisland *island;
+	char byte;
+	group_decided_islands(board, idx, groups);
+	for (i = 0; i < board->num_islands; i++) {
+		labels[i] = -1;
+	}
+	for (j = idx; j < board->num_islands; j++) {
+		island = board->islands + j;
+		up = island->islands[UP] == board->out_island
+				? board->num_islands
+				: island_index(board, island->islands[UP]);
+		if (j > idx && up >= idx) {
+			continue;
+		}
+		group = find_group(groups, j);
+		if (labels[group] < 0 && num_labels == CHAR_MAX) {
+			fprintf(stderr, "Maximum of groups reached: %d\n",
+					num_labels);
+			return -1;
+		}
+		if (labels[group] < 0) {
+			labels[group] = num_labels++;
+		}
+		byte = island->pendbridges
+				| (island->connections[UP]->bridges ? 16 : 0);
+		if (! grow_array((void **) &dd->keys, dd->num_keys + 1,
+				&dd->max_keys, 1)) {
+			return -1;
+		}
+		dd->keys[dd->num_keys++] = byte;
+#ifdef CHECK_CONNECTED_SOLUTION
+		dd->keys[dd->num_keys++] = (char) labels[group];
+#endif
+	}
+#ifdef CHECK_CONNECTED_SOLUTION
+	for (i = 0; i < idx; i++) {
+		group = find_group(groups, i);
+		if (labels[group] == -1) {
+			labels[group] = -2;
+			closed++;
+		}
+	}
+#endif
+	return closed == 0 || (closed == 1 && idx >= board->num_islands);
+}
+
+/** Adds a node with the given edges, or returns an equal existing node. */
+int add_dd_node(hdiagram *dd, int level, hddedge *edges, int num_edges) {
+	hddnode *node;
+	unsigned long hash;
+	int i, pos;
+	if (num_edges == 0) {
+		return 0;
+	}
+	if (! grow_array((void **) &dd->nodes, dd->num_nodes, &dd->max_nodes,
+			sizeof(hddnode)) || ! grow_dd_tables(dd)) {
+		return -1;
+	}
+	for (i = 0; i < num_edges; i++) {
+		if (! grow_array((void **) &dd->edges, dd->num_edges + i,
+				&dd->max_edges, sizeof(hddedge))) {
+			return -1;
+		}
+	}
+	node = dd->nodes + dd->num_nodes;
+	node->level = level;
+	node->first_edge = dd->num_edges;
+	node->num_edges = num_edges;
+	node->count = 0;
+	memcpy(dd->edges + dd->num_edges, edges, num_edges * sizeof(hddedge));
+	hash = hash_bytes((char *) &level, sizeof(level), HASH_OFFSET);
+	hash = hash_bytes((char *) edges, num_edges * sizeof(hddedge), hash);
+	pos = find_dd_entry(dd, dd->uniques, hash, (char *) node, 0, true);
+	if (dd->uniques[pos].node > -1) {
+		return dd->uniques[pos].node;
+	}
+	for (i = 0; i < num_edges; i++) {
+		node->count += dd->nodes[edges[i].child].count;
+	}
+	dd->uniques[pos].hash = hash;
+	dd->uniques[pos].node = dd->num_nodes;
+	dd->num_uniques++;
+	dd->num_edges += num_edges;
+	return dd->num_nodes++;
+}
+
+/** Compiles the solutions from the island with the given index in the
+ * diagram, returning the node of the state of the board or -1 on errors. */
+int compile_from_island(hdiagram *dd, hboard *board, int idx, int *groups,
+		int *labels) {
+	hddedge edges[MAX_ORDERINGS];
+	hisland *island;
+	unsigned long hash;
+	int keyoffset = dd->num_keys, keylength, pos, num_edges = 0, child;
+	int viable;
+	/* the padding of the edges is hashed and compared with the nodes */
+	memset(edges, 0, sizeof(edges));
+	if (! grow_array((void **) &dd->keys, dd->num_keys + sizeof(int),
+			&dd->max_keys, 1)) {
+		return -1;
+	}
+	memcpy(dd->keys + dd->num_keys, &idx, sizeof(int));
+	dd->num_keys += sizeof(int);
+	if ((viable = append_dd_state(dd, board, idx, groups, labels)) < 1) {
+		dd->num_keys = keyoffset;
+		return viable;
+	}
+	if (idx >= board->num_islands) {
+		dd->num_keys = keyoffset;
+		return 1;
+	}
+	keylength = dd->num_keys - keyoffset;
+	hash = hash_bytes(dd->keys + keyoffset, keylength, HASH_OFFSET);
+	if (! grow_dd_tables(dd)) {
+		return -1;
+	}
+	pos = find_dd_entry(dd, dd->states, hash, dd->keys + keyoffset,
+			keylength, false);
+	if (dd->states[pos].node > -1) {
+		dd->num_keys = keyoffset;
+		return dd->states[pos].node;
+	}
+	island = board->islands + idx;
+	if (fill_bridges(island)) {
+		do {
+			child = compile_from_island(dd, board, idx + 1,
+					groups, labels);
+			if (child < 0) {
+				clear_bridges(island);
+				return -1;
+			}
+			if (child > 0) {
+				edges[num_edges].right =
+					island->connections[RIGHT]->bridges;
+				edges[num_edges].down =
+					island->connections[DOWN]->bridges;
+				edges[num_edges++].child = child;
+			}
+		} while (reorder_bridges(island));
+	}
+	if ((child = add_dd_node(dd, idx, edges, num_edges)) < 0) {
+		return -1;
+	}
+	/* the tables could have grown during the compilation of the children */
+	pos = find_dd_entry(dd, dd->states, hash, dd->keys + keyoffset,
+			keylength, false);
+	dd->states[pos].hash = hash;
+	dd->states[pos].node = child;
+	dd->states[pos].keyoffset = keyoffset;
+	dd->states[pos].keylength = keylength;
+	dd->num_states++;
+	return child;
+}
+
+void free_diagram(hdiagram *dd) {
+	free(dd->nodes);
+	free(dd->edges);
+	free(dd->states);
+	free(dd->uniques);
+	free(dd->keys);
+}
+
+/** Compiles all the solutions of the board in the given diagram. */
+bool compile_diagram(hdiagram *dd, hboard *board) {
+	int *groups, *labels;
+	memset(dd, 0, sizeof(hdiagram));
+	if (! grow_array((void **) &dd->nodes, 2, &dd->max_nodes,
+			sizeof(hddnode)) || ! grow_dd_tables(dd)) {
+		return false;
+	}
+	dd->nodes[0].level = dd->nodes[1].level = board->num_islands;
+	dd->nodes[0].first_edge = dd->nodes[1].first_edge = 0;
+	dd->nodes[0].num_edges = dd->nodes[1].num_edges = 0;
+	dd->nodes[0].count = 0;
+	dd->nodes[1].count = 1;
+	dd->num_nodes = 2;
+	groups = malloc((board->num_islands + 1) * sizeof(int));
+	labels = malloc((board->num_islands + 1) * sizeof(int));
+	if (groups == NULL || labels == NULL) {
+		fprintf(stderr, "Not enough memory for the diagram\n");
+		free(groups);
+		free(labels);
+		return false;
+	}
+	dd->root = board->num_islands ? compile_from_island(dd, board, 0,
+			groups, labels) : 0;
+	free(groups);
+	free(labels);
+	return dd->root > -1;
+}
+
+/** Sets the bridges of the RIGHT and DOWN connections of the island of the
+ * node as given in the edge, returning the next node. */
+int follow_dd_edge(hboard *board, hddnode *node, hddedge *edge) {
+	hisland *island = board->islands + node->level;
+	if (island->connections[RIGHT] != board->out_connection) {
+		island->connections[RIGHT]->bridges = edge->right;
+	}
+	if (island->connections[DOWN] != board->out_connection) {
+		island->connections[DOWN]->bridges = edge->down;
+	}
+	return edge->child;
+}
+
+/** Prints the given number of solutions chosen with uniform probability. */
+void sample_diagram(hdiagram *dd, hboard *board, hrandom *rnd, int samples) {
+	hddnode *node;
+	hddedge *edge;
+	double target;
+	int i, node_idx;
+	for (; samples > 0 && dd->nodes[dd->root].count > 0; samples--) {
+		node_idx = dd->root;
+		while (node_idx > 1) {
+			node = dd->nodes + node_idx;
+			target = random_unit(rnd) * node->count;
+			edge = dd->edges + node->first_edge;
+			for (i = 1; i < node->num_edges; i++, edge++) {
+				target -= dd->nodes[edge->child].count;
+				if (target < 0) {
+					break;
+				}
+			}
+			node_idx = follow_dd_edge(board, node, edge);
+		}
+		print_board(board);
+	}
+}
+
+/** Prints the first solutions of the diagram up to the given maximum,
+ * returning the number of solutions remaining to print. */
+int enumerate_diagram(hdiagram *dd, hboard *board, int node_idx, int max) {
+	hddnode *node = dd->nodes + node_idx;
+	int i;
+	if (node_idx == 1) {
+		print_board(board);
+		return max - 1;
+	}
+	for (i = 0; i < node->num_edges && max > 0; i++) {
+		max = enumerate_diagram(dd, board, follow_dd_edge(board, node,
+				dd->edges + node->first_edge + i), max);
+	}
+	return max;
+}
+
+/** Prints the percentage of solutions that have bridges in each connection,
+ * adding the number of paths from the root to each node with the number of
+ * solutions from the child of each edge (the children are always created
+ * before their parents, so the nodes are visited from the last one). */
+bool print_diagram_marginals(hdiagram *dd, hboard *board) {
+	double *paths, *present, *doubled, total = dd->nodes[dd->root].count;
+	hddnode *node;
+	hddedge *edge;
+	hisland *island, *other;
+	int i, j, dir, size = board->num_islands * DIRECTIONS;
+	paths = calloc(dd->num_nodes, sizeof(double));
+	present = calloc(size + 1, sizeof(double));
+	doubled = calloc(size + 1, sizeof(double));
+	if (paths == NULL || present == NULL || doubled == NULL) {
+		fprintf(stderr, "Not enough memory for the marginals\n");
+		free(paths);
+		free(present);
+		free(doubled);
+		return false;
+	}
+	paths[dd->root] = 1;
+	for (i = dd->num_nodes - 1; i > 1; i--) {
+		node = dd->nodes + i;
+		for (j = 0; j < node->num_edges; j++) {
+			edge = dd->edges + node->first_edge + j;
+			paths[edge->child] += paths[i];
+			if (edge->right) {
+				present[node->level * DIRECTIONS + RIGHT] +=
+					paths[i] * dd->nodes[edge->child].count;
+			}
+			if (edge->right == MAX_CONNECTION_BRIDGES) {
+				doubled[node->level * DIRECTIONS + RIGHT] +=
+					paths[i] * dd->nodes[edge->child].count;
+			}
+			if (edge->down) {
+				present[node->level * DIRECTIONS + DOWN] +=
+					paths[i] * dd->nodes[edge->child].count;
+			}
+			if (edge->down == MAX_CONNECTION_BRIDGES) {
+				doubled[node->level * DIRECTIONS + DOWN] +=
+					paths[i] * dd->nodes[edge->child].count;
+			}
+		}
+	}
+	for (i = 0; i < board->num_islands && total > 0; i++) {
+		island = board->islands + i;
+		for (dir = RIGHT; dir <= DOWN; dir++) {
+			other = island->islands[dir];
+			if (other == board->out_island) {
+				continue;
+			}
+			printf("%d,%d - %d,%d: bridges in %.1f%%, "
+				"double in %.1f%%\n", island->row, island->col,
+				other->row, other->col,
+				100 * present[i * DIRECTIONS + dir] / total,
+				100 * doubled[i * DIRECTIONS + dir] / total);
+		}
+	}
+	free(paths);
+	free(present);
+	free(doubled);
+	return true;
+}
+
+/** Compiles the solutions of the board in a decision diagram and prints
+ * the number of solutions and the size of the diagram, then the requested
+ * uniform samples, the marginals of the connections and the first solutions.*/
+bool solve_diagram(hboard *board, hrandom *rnd, int samples, bool marginals,
+		int max_enumerated) {
+	hdiagram dd;
+	bool ok = true;
+	if (! valid_visited_matrix_size(board)) {
+		return false;
+	}
+	if (! compile_diagram(&dd, board)) {
+		free_diagram(&dd);
+		return false;
+	}
+	printf("Solutions: %.0f\n", dd.nodes[dd.root].count);
+	printf("Diagram nodes: %d, edges: %d, states: %d\n",
+			dd.num_nodes, dd.num_edges, dd.num_states);
+	if (samples > 0) {
+		sample_diagram(&dd, board, rnd, samples);
+	}
+	if (marginals) {
+		ok = print_diagram_marginals(&dd, board);
+	}
+	if (max_enumerated > 0 && dd.root > 0) {
+		enumerate_diagram(&dd, board, dd.root, max_enumerated);
+	}
+	free_diagram(&dd);
+	return ok;
+}
+
+/** Entry of the states of a frontier of the board, with the number of partial
+ * solutions that reach it (real, as in the diagram, because it can be huge)
+ * and the next entry with the same first bytes of the key (the bridges of
+ * the cut in the meet-in-the-middle count). */
+typedef struct st_hstateentry {
+	double count;
+	int next;
+} hstateentry;
+
+/** States of a frontier of the board: their entries and their keys (in the
+ * same order), a hash table of positions of entries by the whole key and
+ * another one by the first bytes of the key, which links the entries. */
+typedef struct st_hstates {
+	hstateentry *entries;
+	int num_entries, max_entries;
+	char *keys;
+	int num_keys, max_keys;
+	int *slots, *heads;
+	int max_slots;
+} hstates;
+
+/** State of the meet-in-the-middle count: the islands are split at a row
+ * (the first island of the row is the cut) and the partial solutions of the
+ * islands above and below it are found independently, keeping only their
+ * states at the cut: the bridges of the connections crossing it (the DOWN
+ * connections of the islands above it to islands below it) and which of
+ * them are connected inside the half. Two states with the same bridges give
+ * solutions of the whole board when the connections joined by both halves
+ * are all connected, so the solutions are the sum of the products of the
+ * counts of those pairs. */
+typedef struct st_hmiddle {
+	hboard *board;
+	int cut, num_crossing, keylength;
+	int *crossing, *groups, *labels, *joined;
+	char *key;
+	bool failed;
+	hstates halves[2];
+} hmiddle;
+
+/** Returns the position of the given table of the states where the entry with
+ * the given first bytes of its key is or must be inserted. */
+int find_state_slot(hstates *states, int *slots, int keylength, const char *key,
+		int length) {
+	int pos = (int) (hash_bytes(key, length, HASH_OFFSET)
+			& (states->max_slots - 1));
+	for (;; pos = (pos + 1) & (states->max_slots - 1)) {
+		if (slots[pos] < 0 || memcmp(states->keys + (size_t) slots[pos]
+				* keylength, key, length) == 0) {
+			return pos;
+		}
+	}
+}
+
+/** Doubles the size of the hash table of the states when it is half full. */
+bool grow_state_slots(hstates *states, int keylength) {
+	int *slots, i, oldmax = states->max_slots;
+	if (2 * (states->num_entries + 1) < states->max_slots) {
+		return true;
+	}
+	states->max_slots = oldmax ? oldmax * 2 : 1024;
+	if ((slots = malloc(states->max_slots * sizeof(int))) == NULL) {
+		fprintf(stderr, "Not enough memory for %d states\n",
+				states->max_slots);
+		return false;
+	}
+	for (i = 0; i < states->max_slots; i++) {
+		slots[i] = -1;
+	}
+	free(states->slots);
+	states->slots = slots;
+	for (i = 0; i < states->num_entries; i++) {
+		slots[find_state_slot(states, slots, keylength, states->keys
+				+ (size_t) i * keylength, keylength)] = i;
+	}
+	return true;
+}
+
+/** Adds the given number of partial solutions with the given key to the
+ * states, returning the position of its entry or -1 if there is no memory.*/
+int add_state(hstates *states, const char *key, int keylength,
+		double count) {
+	int pos, entry;
+	if (! grow_state_slots(states, keylength)) {
+		return -1;
+	}
+	pos = find_state_slot(states, states->slots, keylength, key, keylength);
+	if ((entry = states->slots[pos]) < 0) {
+		entry = states->num_entries;
+		if (! grow_array((void **) &states->entries, entry,
+				&states->max_entries, sizeof(hstateentry))
+				|| ! grow_array((void **) &states->keys,
+				states->num_keys + keylength, &states->max_keys,
+				1)) {
+			return -1;
+		}
+		memcpy(states->keys + states->num_keys, key, keylength);
+		states->num_keys += keylength;
+		states->entries[entry].count = 0;
+		states->num_entries++;
+		states->slots[pos] = entry;
+	}
+	states->entries[entry].count += count;
+	return entry;
+}
+
+/** Links the entries of the states with the same first bytes of the key. */
+bool link_states(hstates *states, int keylength, int length) {
+	int i, pos;
+	if ((states->heads = malloc((states->max_slots + 1) * sizeof(int)))
+			== NULL) {
+		fprintf(stderr, "Not enough memory for %d states\n",
+				states->max_slots);
+		return false;
+	}
+	for (i = 0; i < states->max_slots; i++) {
+		states->heads[i] = -1;
+	}
+	for (i = 0; i < states->num_entries; i++) {
+		pos = find_state_slot(states, states->heads, keylength,
+				states->keys + (size_t) i * keylength, length);
+		states->entries[i].next = states->heads[pos];
+		states->heads[pos] = i;
+	}
+	return true;
+}
+
+void free_states(hstates *states) {
+	free(states->entries);
+	free(states->keys);
+	free(states->slots);
+	free(states->heads);
+}
+
+/** Writes in the key of the middle the state of the top or bottom half at the
+ * cut, returning false if a group of islands of the half is closed (it has
+ * no bridges crossing the cut), because the other half is not empty, or if
+ * the groups do not fit in the key (then the middle is failed). */
+bool write_half_key(hmiddle *middle, bool top) {
+	hboard *board = middle->board;
+	hisland *island;
+	hconnection *conn;
+	int k = middle->num_crossing, from = top ? 0 : middle->cut;
+	int to = top ? middle->cut : board->num_islands, i, j, dir, group;
+	int num_labels = 0;
+	for (i = 0; i < board->num_islands; i++) {
+		middle->groups[i] = i;
+		middle->labels[i] = -1;
+	}
+	for (i = from; i < to; i++) {
+		island = board->islands + i;
+		for (dir = RIGHT; dir <= DOWN; dir++) {
+			if (island->connections[dir]->bridges && island_index(
+					board, island->islands[dir]) < to) {
+				middle->groups[find_group(middle->groups, i)]
+					= find_group(middle->groups,
+					island_index(board,
+					island->islands[dir]));
+			}
+		}
+	}
+	for (j = 0; j < k; j++) {
+		conn = board->connections + middle->crossing[j];
+		middle->key[j] = conn->bridges;
+		middle->key[k + j] = -1;
+#ifdef CHECK_CONNECTED_SOLUTION
+		if (conn->bridges) {
+			group = find_group(middle->groups,
+					connection_end(board, conn, top));
+			if (middle->labels[group] < 0
+					&& num_labels == CHAR_MAX) {
+				fprintf(stderr, "Maximum of groups reached: "
+						"%d\n", num_labels);
+				middle->failed = true;
+				return false;
+			}
+			if (middle->labels[group] < 0) {
+				middle->labels[group] = num_labels++;
+			}
+			middle->key[k + j] = (char) middle->labels[group];
+		}
+#endif
+	}
+#ifdef CHECK_CONNECTED_SOLUTION
+	for (i = from; i < to; i++) {
+		if (middle->labels[find_group(middle->groups, i)] < 0) {
+			return false;
+		}
+	}
+#endif
+	return true;
+}
+
+/** Returns false if an island connected RIGHT or DOWN to the island before
+ * the given index can no longer build its pending bridges in its connections
+ * not decided yet (to the islands from the given index). */
+bool neighbours_fit(hboard *board, int idx) {
+	hisland *island = board->islands + (idx - 1), *next;
+	hconnection *conn;
+	int dir, d, room;
+	for (dir = RIGHT; dir <= DOWN; dir++) {
+		next = island->islands[dir];
+		if (next == board->out_island || next->pendbridges == 0) {
+			continue;
+		}
+		room = 0;
+		for (d = 0; d < DIRECTIONS; d++) {
+			conn = next->connections[d];
+			if (conn != board->out_connection && island_index(board,
+					next->islands[d]) >= idx
+					&& ! crossed_connection(conn)) {
+				room += connection_capacity(conn);
+			}
+		}
+		if (room < next->pendbridges) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Finds the partial solutions of the top or bottom half from the given
+ * island, adding their states at the cut. The islands of the top half are
+ * the first ones of the search, so they can be pruned as in the search of
+ * the whole board. The islands above the bottom half are not decided, so
+ * its islands are only pruned when the next ones cannot be completed. */
+void find_half_states(hmiddle *middle, int idx, bool top) {
+	hboard *board = middle->board;
+	if (middle->failed) {
+		return;
+	}
+	if (idx >= (top ? middle->cut : board->num_islands)) {
+		if (write_half_key(middle, top) && add_state(
+				middle->halves + ! top, middle->key,
+				middle->keylength, 1) < 0) {
+			middle->failed = true;
+		}
+		return;
+	}
+	if (top) {
+		if (prune_node(board, idx)) {
+			return;
+		}
+	} else {
+		board->stats.nodes++;
+		if (idx > middle->cut && ! neighbours_fit(board, idx)) {
+			return;
+		}
+	}
+	if (fill_bridges(board->islands + idx)) {
+		find_half_states(middle, idx + 1, top);
+		while (reorder_bridges(board->islands + idx)) {
+			find_half_states(middle, idx + 1, top);
+		}
+	}
+}
+
+/** Finds the partial solutions of the bottom half only with the bridges of
+ * the connections of the cut of some state of the top half, adding them to
+ * the connections before searching the bottom islands. */
+void find_cut_bridges(hmiddle *middle) {
+	hstates cuts;
+	hconnection *conn;
+	const char *bridges;
+	int i, j, k = middle->num_crossing;
+	bool valid;
+	memset(&cuts, 0, sizeof(hstates));
+	for (i = 0; i < middle->halves[0].num_entries; i++) {
+		if (add_state(&cuts, middle->halves[0].keys + (size_t) i
+				* middle->keylength, k, 1) < 0) {
+			middle->failed = true;
+		}
+	}
+	for (i = 0; i < cuts.num_entries && ! middle->failed; i++) {
+		bridges = cuts.keys + (size_t) i * k;
+		valid = true;
+		for (j = 0; j < k && valid; j++) {
+			conn = middle->board->connections + middle->crossing[j];
+			while (valid && conn->bridges < bridges[j]) {
+				valid = add_bridge(conn);
+			}
+		}
+		if (valid) {
+			find_half_states(middle, middle->cut, false);
+		}
+		for (j = 0; j < k; j++) {
+			conn = middle->board->connections + middle->crossing[j];
+			while (del_bridge(conn));
+		}
+	}
+	free_states(&cuts);
+}
+
+/** Returns true if the connections of the cut with bridges are all joined by
+ * the groups of the two halves given by their keys. */
+bool joined_halves(hmiddle *middle, const char *top, const char *bottom) {
+#ifdef CHECK_CONNECTED_SOLUTION
+	int k = middle->num_crossing, j, roots = 0;
+	int *joined = middle->joined, *firsts = middle->joined + k;
+	for (j = 0; j < k; j++) {
+		joined[j] = j;
+		firsts[j] = firsts[k + j] = -1;
+	}
+	for (j = 0; j < k; j++) {
+		if (top[j] == 0) {
+			continue;
+		}
+		if (firsts[(int) top[k + j]] < 0) {
+			firsts[(int) top[k + j]] = j;
+		} else {
+			joined[find_group(joined, j)] = find_group(joined,
+					firsts[(int) top[k + j]]);
+		}
+		if (firsts[k + bottom[k + j]] < 0) {
+			firsts[k + bottom[k + j]] = j;
+		} else {
+			joined[find_group(joined, j)] = find_group(joined,
+					firsts[k + bottom[k + j]]);
+		}
+	}
+	for (j = 0; j < k; j++) {
+		if (top[j] && find_group(joined, j) == j) {
+			roots++;
+		}
+	}
+	return roots == 1;
+#else
+	return true;
+#endif
+}
+
+/** Returns the sum of the products of the counts of the compatible states of
+ * the two halves, finding the states of the bottom half with the same bridges
+ * of each state of the top half. */
+double join_halves(hmiddle *middle) {
+	hstates *top = middle->halves, *bottom = middle->halves + 1;
+	double total = 0;
+	const char *key;
+	int i, b;
+	if (bottom->heads == NULL) {
+		return 0;
+	}
+	for (i = 0; i < top->num_entries; i++) {
+		key = top->keys + (size_t) i * middle->keylength;
+		b = bottom->heads[find_state_slot(bottom, bottom->heads,
+				middle->keylength, key, middle->num_crossing)];
+		for (; b > -1; b = bottom->entries[b].next) {
+			if (joined_halves(middle, key, bottom->keys + (size_t) b
+					* middle->keylength)) {
+				total += top->entries[i].count
+						* bottom->entries[b].count;
+			}
+		}
+	}
+	return total;
+}
+
+/** Chooses the row to split the islands with the fewest connections crossing
+ * it, preferring the rows that leave at least a quarter of the islands in
+ * each half and then the most balanced ones. Returns false if the islands
+ * are all in one row. */
+bool choose_middle_cut(hmiddle *middle) {
+	hboard *board = middle->board;
+	hisland *island;
+	int n = board->num_islands, row, cut, i, k, best = -1;
+	bool balanced, bestbalanced = false;
+	for (cut = 1; cut < n; cut++) {
+		row = board->islands[cut].row;
+		if (row == board->islands[cut - 1].row) {
+			continue;
+		}
+		k = 0;
+		for (i = 0; i < cut; i++) {
+			island = board->islands + i;
+			if (island->islands[DOWN] != board->out_island
+					&& island->islands[DOWN]->row >= row) {
+				k++;
+			}
+		}
+		balanced = 4 * cut >= n && 4 * (n - cut) >= n;
+		if (best < 0 || (balanced && ! bestbalanced)
+				|| (balanced == bestbalanced
+				&& (k < middle->num_crossing
+				|| (k == middle->num_crossing
+				&& abs(n - 2 * cut)
+				< abs(n - 2 * middle->cut))))) {
+			best = row;
+			bestbalanced = balanced;
+			middle->cut = cut;
+			middle->num_crossing = k;
+		}
+	}
+	return best > -1;
+}
+
+/** Prints only the number of solutions of the board found by counting the
+ * states of two halves of the board at a row and joining them, or found by
+ * the search of the whole board if all the islands are in one row. */
+bool solve_board_middle(hboard *board) {
+	hmiddle middle;
+	int n = board->num_islands, i, k = 0;
+	bool solved = true;
+	board->count_only = true;
+	if (n && ! valid_visited_matrix_size(board)) {
+		return false;
+	}
+	memset(&middle, 0, sizeof(hmiddle));
+	middle.board = board;
+	if (! choose_middle_cut(&middle)) {
+		if (n) {
+			find_solutions_from_island(board, 0);
+		}
+		print_count(board);
+		return true;
+	}
+	middle.keylength = 2 * middle.num_crossing;
+	middle.crossing = malloc((middle.num_crossing + 1) * sizeof(int));
+	middle.groups = malloc((n + 1) * sizeof(int));
+	middle.labels = malloc((n + 1) * sizeof(int));
+	middle.joined = malloc((3 * middle.num_crossing + 1) * sizeof(int));
+	middle.key = malloc(middle.keylength + 1);
+	if (middle.crossing == NULL || middle.groups == NULL
+			|| middle.labels == NULL || middle.joined == NULL
+			|| middle.key == NULL) {
+		fprintf(stderr, "Not enough memory for the halves\n");
+		solved = false;
+	} else {
+		for (i = 0; i < middle.cut; i++) {
+			if (board->islands[i].islands[DOWN] != board->out_island
+					&& island_index(board, board->islands[i]
+					.islands[DOWN]) >= middle.cut) {
+				middle.crossing[k++] = connection_index(board,
+					board->islands[i].connections[DOWN]);
+			}
+		}
+		find_half_states(&middle, 0, true);
+		find_cut_bridges(&middle);
+		board->stats.top_states = middle.halves[0].num_entries;
+		board->stats.bottom_states = middle.halves[1].num_entries;
+		if (middle.failed || (middle.halves[1].num_entries
+				&& ! link_states(middle.halves + 1,
+				middle.keylength, middle.num_crossing))) {
+			solved = false;
+		} else {
+			fprintf(board->out, "Solutions: %.0f\n",
+					join_halves(&middle));
+		}
+	}
+	free(middle.crossing);
+	free(middle.groups);
+	free(middle.labels);
+	free(middle.joined);
+	free(middle.key);
+	free_states(middle.halves);
+	free_states(middle.halves + 1);
+	return solved;
+}
+
+/** Row of the board read by the streaming solver with the states of the
+ * frontier below it: for each column the bridges of the connection going
+ * down from its last island (which cross the next rows until an island),
+ * the group of that island among the groups of the islands read, and then
+ * whether no island was read yet, the islands are open or they already are
+ * one closed group (the solution is finished). In the search of one solution
+ * each state also keeps its parent state in the previous row and the bridges
+ * of the islands of the row that lead to it (UP times 3 plus RIGHT). */
+typedef struct st_hlayer {
+	int row, width, num_islands;
+	int *cols, *uprows;
+	char *expects;
+	hstates states;
+	int *parents;
+	char *choices;
+	int max_parents, max_choices;
+} hlayer;
+
+/** State of the streaming solver, which reads the board row by row and keeps
+ * only the rows of the band not written yet (only the last one when it is
+ * counting), so its memory does not depend on the height of the board.
+ * The last row of each column, the islands of the row being read and the
+ * bridges chosen for them are kept for the widest row read. */
+typedef struct st_hstream {
+	bool count_only, discarded;
+	int band, max_width, num_layers, num_islands, max_live, max_seen;
+	int *lastrow, *cols, *groups, *labels, *path, *live;
+	char *row, *expects, *ups, *rights, *downs, *key, *seen;
+	hlayer *layers;
+} hstream;
+
+int layer_key_length(hlayer *layer) {
+	return 2 * layer->width + 1;
+}
+
+/** Frees the states of the layer, keeping its islands. */
+void clear_layer(hlayer *layer) {
+	free_states(&layer->states);
+	free(layer->parents);
+	free(layer->choices);
+	memset(&layer->states, 0, sizeof(hstates));
+	layer->parents = NULL;
+	layer->choices = NULL;
+	layer->max_parents = layer->max_choices = 0;
+}
+
+void free_layer(hlayer *layer) {
+	free(layer->cols);
+	free(layer->uprows);
+	free(layer->expects);
+	clear_layer(layer);
+}
+
+/** Grows the arrays of the stream to read rows of the given width. */
+bool grow_stream(hstream *stream, int width) {
+	int oldmax = stream->max_width, c;
+	void **arrays[] = { (void **) &stream->lastrow,
+		(void **) &stream->cols, (void **) &stream->groups,
+		(void **) &stream->labels, (void **) &stream->expects,
+		(void **) &stream->ups, (void **) &stream->rights,
+		(void **) &stream->downs, (void **) &stream->key };
+	size_t sizes[] = { sizeof(int), sizeof(int), 2 * sizeof(int),
+		2 * sizeof(int), 1, 1, 1, 1, 2 };
+	unsigned i;
+	void *grown;
+	if (width <= oldmax) {
+		return true;
+	}
+	for (stream->max_width = oldmax ? oldmax : 64;
+			stream->max_width < width; stream->max_width *= 2);
+	for (i = 0; i < sizeof(sizes) / sizeof(size_t); i++) {
+		if ((grown = realloc(*arrays[i], sizes[i]
+				* (stream->max_width + 1))) == NULL) {
+			fprintf(stderr, "Not enough memory for %d columns\n",
+					stream->max_width);
+			return false;
+		}
+		*arrays[i] = grown;
+	}
+	for (c = oldmax; c < stream->max_width; c++) {
+		stream->lastrow[c] = -1;
+	}
+	return true;
+}
+
+/** Adds to the layer the state reached from the given state of the previous
+ * layer with the bridges chosen for the islands of the row, unless a group
+ * of islands is closed while others are not (then the state is discarded).*/
+bool add_row_state(hstream *stream, hlayer *prev, int s, hlayer *layer) {
+	const char *old = prev->states.keys + (size_t) s
+			* layer_key_length(prev);
+	int w0 = prev->width, w = layer->width, m = layer->num_islands;
+	int c, d, i, j, entry, node, nodes = 0;
+	char flag = old[2 * w0];
+#ifdef CHECK_CONNECTED_SOLUTION
+	int *groups = stream->groups, *labels = stream->labels, root;
+	int num_labels = 0, open = 0, closed = 0;
+	for (c = 0; c < w0; c++) {
+		if (old[c] && old[w0 + c] >= nodes) {
+			nodes = old[w0 + c] + 1;
+		}
+	}
+	for (i = 0; i < nodes + m; i++) {
+		groups[i] = i;
+		labels[i] = -1;
+	}
+	for (j = 0; j < m; j++) {
+		if (stream->ups[j]) {
+			groups[find_group(groups, nodes + j)] = find_group(
+					groups, old[w0 + layer->cols[j]]);
+		}
+		if (stream->rights[j]) {
+			groups[find_group(groups, nodes + j)] = find_group(
+					groups, nodes + j + 1);
+		}
+	}
+#endif
+	for (c = 0, j = 0; c < w; c++) {
+		if (j < m && layer->cols[j] == c) {
+			d = stream->downs[j];
+			node = nodes + j++;
+		} else {
+			d = c < w0 ? old[c] : 0;
+			node = d ? old[w0 + c] : -1;
+		}
+		stream->key[c] = (char) d;
+		stream->key[w + c] = -1;
+#ifdef CHECK_CONNECTED_SOLUTION
+		if (d) {
+			root = find_group(groups, node);
+			if (labels[root] < 0 && num_labels == CHAR_MAX) {
+				fprintf(stderr, "Maximum of groups reached: "
+						"%d\n", num_labels);
+				return false;
+			}
+			if (labels[root] < 0) {
+				labels[root] = num_labels++;
+			}
+			stream->key[w + c] = (char) labels[root];
+			open++;
+		}
+#else
+		(void) node;
+#endif
+	}
+	if (m) {
+		flag = 1;
+	}
+#ifdef CHECK_CONNECTED_SOLUTION
+	for (i = 0; i < nodes + m; i++) {
+		root = find_group(groups, i);
+		if (labels[root] == -1) {
+			labels[root] = -2;
+			closed++;
+		}
+	}
+	if (closed == 1 && open == 0) {
+		flag = 2;
+	} else if (closed) {
+		return true;
+	}
+#endif
+	stream->key[2 * w] = flag;
+	i = layer->states.num_entries;
+	entry = add_state(&layer->states, stream->key, layer_key_length(layer),
+			prev->states.entries[s].count);
+	if (entry < 0) {
+		return false;
+	}
+	if (! stream->count_only && entry == i) {
+		if (! grow_array((void **) &layer->parents, entry,
+				&layer->max_parents, sizeof(int))
+				|| ! grow_array((void **) &layer->choices,
+				(entry + 1) * m, &layer->max_choices, 1)) {
+			return false;
+		}
+		layer->parents[entry] = s;
+		for (j = 0; j < m; j++) {
+			layer->choices[entry * m + j] = (char) (stream->ups[j]
+					* (MAX_CONNECTION_BRIDGES + 1)
+					+ stream->rights[j]);
+		}
+	}
+	return true;
+}
+
+/** Chooses the bridges of the islands of the row from the given one, coming
+ * from the given state of the previous layer: the UP bridges are given by the
+ * state, the RIGHT ones cannot cross the connections going down and the DOWN
+ * ones complete the island. */
+bool find_row_bridges(hstream *stream, hlayer *prev, int s, hlayer *layer,
+		int j) {
+	const char *old = prev->states.keys + (size_t) s
+			* layer_key_length(prev);
+	int m = layer->num_islands, c, need, right, maxright = 0;
+	if (j >= m) {
+		return add_row_state(stream, prev, s, layer);
+	}
+	c = layer->cols[j];
+	stream->ups[j] = c < prev->width ? old[c] : 0;
+	need = layer->expects[j] - stream->ups[j]
+			- (j ? stream->rights[j - 1] : 0);
+	if (j + 1 < m) {
+		maxright = MAX_CONNECTION_BRIDGES;
+		for (c++; c < layer->cols[j + 1] && c < prev->width; c++) {
+			if (old[c]) {
+				maxright = 0;
+			}
+		}
+	}
+	for (right = 0; right <= maxright && right <= need; right++) {
+		if (need - right <= MAX_CONNECTION_BRIDGES) {
+			stream->rights[j] = (char) right;
+			stream->downs[j] = (char) (need - right);
+			if (! find_row_bridges(stream, prev, s, layer, j + 1)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/** Prints the connections with bridges that end in the islands of the layer
+ * (from above or from the left) in the given state. */
+void print_layer_bridges(hlayer *layer, int s) {
+	int j, up, right, m = layer->num_islands;
+	for (j = 0; j < m; j++) {
+		up = layer->choices[s * m + j] / (MAX_CONNECTION_BRIDGES + 1);
+		right = layer->choices[s * m + j]
+				% (MAX_CONNECTION_BRIDGES + 1);
+		if (up) {
+			printf("%d,%d - %d,%d: %d\n", layer->uprows[j],
+					layer->cols[j], layer->row,
+					layer->cols[j], up);
+		}
+		if (right) {
+			printf("%d,%d - %d,%d: %d\n", layer->row,
+					layer->cols[j], layer->row,
+					layer->cols[j + 1], right);
+		}
+	}
+}
+
+/** Adds to the layer the states reached from the states of the previous one.
+ * The finished states can only be followed by rows without islands. */
+bool expand_layer(hstream *stream, hlayer *prev, hlayer *layer) {
+	int s;
+	bool finished;
+	for (s = 0; s < prev->states.num_entries; s++) {
+		finished = prev->states.keys[(size_t) (s + 1)
+				* layer_key_length(prev) - 1] == 2;
+		if (prev->states.entries[s].count
+				&& (layer->num_islands == 0 || ! finished)
+				&& ! find_row_bridges(stream, prev, s, layer,
+				0)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Prints the bridges of the layers from the second one to the given one in
+ * the path to its given state and frees the layers before the given one. */
+void write_layers(hstream *stream, int k, int s) {
+	int i, t;
+	for (i = k, t = s; i > 0; i--) {
+		stream->path[i] = t;
+		t = stream->layers[i].parents[t];
+	}
+	for (i = 1; i <= k; i++) {
+		print_layer_bridges(stream->layers + i, stream->path[i]);
+	}
+	for (i = 0; i < k; i++) {
+		free_layer(stream->layers + i);
+	}
+	memmove(stream->layers, stream->layers + k,
+			(stream->num_layers - k) * sizeof(hlayer));
+	stream->num_layers -= k;
+}
+
+/** Returns true if the state of the layer is a whole solution: one group of
+ * islands closed, or with all the islands complete if the groups of islands
+ * are not checked. */
+bool finished_state(hlayer *layer, int s) {
+	const char *key = layer->states.keys + (size_t) s
+			* layer_key_length(layer);
+#ifdef CHECK_CONNECTED_SOLUTION
+	return layer->states.entries[s].count && key[2 * layer->width] == 2;
+#else
+	int c;
+	for (c = 0; c < layer->width; c++) {
+		if (key[c]) {
+			return false;
+		}
+	}
+	return layer->states.entries[s].count && key[2 * layer->width];
+#endif
+}
+
+/** Returns the last layer whose states lead to the partial solutions of the
+ * last layer through only one of them, storing that state (the layers up to
+ * it can be written without losing solutions), 0 when that is only the first
+ * layer, -1 if the last layer has no partial solutions and -2 on errors. */
+int converged_layer(hstream *stream, int *state) {
+	hlayer *last = stream->layers + stream->num_layers - 1, *prev;
+	int i, t, a, n = 0, m;
+	for (t = 0; t < last->states.num_entries; t++) {
+		if (last->states.entries[t].count) {
+			if (! grow_array((void **) &stream->live, n,
+					&stream->max_live, sizeof(int))) {
+				return -2;
+			}
+			stream->live[n++] = t;
+		}
+	}
+	if (n == 0) {
+		return -1;
+	}
+	for (i = stream->num_layers - 1; n > 1 && i > 0; i--) {
+		prev = stream->layers + i - 1;
+		if (! grow_array((void **) &stream->seen,
+				prev->states.num_entries, &stream->max_seen,
+				1)) {
+			return -2;
+		}
+		memset(stream->seen, 0, prev->states.num_entries);
+		for (t = 0, m = 0; t < n; t++) {
+			a = stream->layers[i].parents[stream->live[t]];
+			if (! stream->seen[a]) {
+				stream->seen[a] = 1;
+				stream->live[m++] = a;
+			}
+		}
+		n = m;
+	}
+	*state = stream->live[0];
+	return n == 1 ? i : 0;
+}
+
+/** Writes the layers of the band when it is full up to the last one whose
+ * states lead to the partial solutions of the last row through one of them,
+ * which loses no solution. If there is none the band grows, up to
+ * STREAM_DEFER_BANDS times its rows: then the first half is written with the
+ * state of the middle row that most finished solutions of the last row come
+ * from (most partial solutions if none is finished), and the states of the
+ * next rows are computed again from that state only. When the last row has
+ * no states there is no solution, so only that row is kept. */
+bool write_full_band(hstream *stream) {
+	hlayer *last = stream->layers + stream->num_layers - 1, *middle;
+	int k, i, t, a, best = -1, chosen = 0;
+	bool finished = false;
+	double *votes;
+	if (stream->num_layers <= stream->band + 1) {
+		return true;
+	}
+	if ((k = converged_layer(stream, &best)) < -1) {
+		return false;
+	} else if (k > 0) {
+		write_layers(stream, k, best);
+		return true;
+	} else if (k == 0 && stream->num_layers
+			<= STREAM_DEFER_BANDS * stream->band + 1) {
+		return true;
+	}
+	for (t = 0; t < last->states.num_entries && ! finished; t++) {
+		finished = finished_state(last, t);
+	}
+	k = (stream->num_layers - 1) / 2;
+	best = -1;
+	middle = stream->layers + k;
+	if ((votes = calloc(middle->states.num_entries + 1, sizeof(double)))
+			== NULL) {
+		fprintf(stderr, "Not enough memory for %d states\n",
+				middle->states.num_entries);
+		return false;
+	}
+	for (t = 0; t < last->states.num_entries; t++) {
+		if (last->states.entries[t].count
+				&& (! finished || finished_state(last, t))) {
+			for (a = t, i = stream->num_layers - 1; i > k; i--) {
+				a = stream->layers[i].parents[a];
+			}
+			chosen += votes[a] == 0;
+			votes[a] += last->states.entries[t].count;
+			if (best < 0 || votes[a] > votes[best]) {
+				best = a;
+			}
+		}
+	}
+	free(votes);
+	if (chosen > 1) {
+		stream->discarded = true;
+	}
+	if (best < 0) {
+		for (i = 0; i < stream->num_layers - 1; i++) {
+			free_layer(stream->layers + i);
+		}
+		stream->layers[0] = *last;
+		stream->num_layers = 1;
+		return true;
+	}
+	write_layers(stream, k, best);
+	for (t = 0; t < stream->layers[0].states.num_entries; t++) {
+		if (t != best) {
+			stream->layers[0].states.entries[t].count = 0;
+		}
+	}
+	for (i = 1; i < stream->num_layers; i++) {
+		clear_layer(stream->layers + i);
+		if (! expand_layer(stream, stream->layers + i - 1,
+				stream->layers + i)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Adds the layer of the given row of text (the characters between two
+ * separators) with the states reached from the states of the last layer. */
+bool read_stream_row(hstream *stream, int row, const char *text, int length) {
+	hlayer *prev, *layer;
+	int i, c = 0, m = 0;
+	for (i = 0; i < length; i++) {
+		c += text[i] == '.' || (text[i] >= '0' && text[i] <= '9');
+	}
+	if (! grow_stream(stream, c)) {
+		return false;
+	}
+	for (i = 0, c = 0; i < length; i++) {
+		if (text[i] > '0' && text[i] <= '9') {
+			if (text[i] - '0' > MAX_EXPECTED_BRIDGES) {
+				fprintf(stderr, "Bad number of bridges: %d\n",
+						text[i] - '0');
+				return false;
+			}
+			stream->cols[m] = c;
+			stream->expects[m++] = (char) (text[i] - '0');
+		}
+		c += text[i] == '.' || (text[i] >= '0' && text[i] <= '9');
+	}
+	prev = stream->layers + stream->num_layers - 1;
+	layer = stream->layers + stream->num_layers;
+	memset(layer, 0, sizeof(hlayer));
+	layer->row = row;
+	layer->width = c > prev->width ? c : prev->width;
+	layer->num_islands = m;
+	layer->cols = malloc((m + 1) * sizeof(int));
+	layer->uprows = malloc((m + 1) * sizeof(int));
+	layer->expects = malloc(m + 1);
+	if (layer->cols == NULL || layer->uprows == NULL
+			|| layer->expects == NULL) {
+		fprintf(stderr, "Not enough memory for %d islands\n", m);
+		free_layer(layer);
+		return false;
+	}
+	stream->num_layers++;
+	for (i = 0; i < m; i++) {
+		layer->cols[i] = stream->cols[i];
+		layer->uprows[i] = stream->lastrow[stream->cols[i]];
+		layer->expects[i] = stream->expects[i];
+		stream->lastrow[stream->cols[i]] = row;
+	}
+	if (! expand_layer(stream, prev, layer)) {
+		return false;
+	}
+	if (stream->count_only) {
+		free_layer(stream->layers);
+		stream->layers[0] = *layer;
+		stream->num_layers = 1;
+		return true;
+	}
+	return write_full_band(stream);
+}
+
+/** Counts the solutions of the board read from the standard input, or finds
+ * one of them, processing it row by row (rows separated by newlines or
+ * slashes) and keeping only the states of the frontier of the last row, or
+ * of the last rows of the given band when finding one solution. That solution
+ * is printed in bands as the connections with bridges (one per line, as in
+ * --format=delta): when the band is full the rows are written up to the last
+ * one whose states lead to all the partial solutions through only one of
+ * them. Only when there is none for STREAM_DEFER_BANDS times the band a state
+ * of the middle row is chosen and the states that do not come from it are
+ * discarded, so the solution may be lost then. */
+bool solve_stream(bool count_only, int band) {
+	hstream stream;
+	hlayer *last;
+	char key = 0;
+	int c, length = 0, max_length = 0, row = 0, s, found = -1;
+	double total = 0;
+	bool ok = true;
+	memset(&stream, 0, sizeof(hstream));
+	stream.count_only = count_only;
+	stream.band = band;
+	stream.layers = calloc(STREAM_DEFER_BANDS * band + 2, sizeof(hlayer));
+	stream.path = malloc((STREAM_DEFER_BANDS * band + 2) * sizeof(int));
+	if (stream.layers == NULL || stream.path == NULL) {
+		fprintf(stderr, "Not enough memory for %d rows\n", band);
+		ok = false;
+	} else if (add_state(&stream.layers[0].states, &key, 1, 1) < 0) {
+		ok = false;
+	} else {
+		stream.num_layers = 1;
+		stream.layers[0].row = -1;
+	}
+	while (ok) {
+		c = getchar();
+		if (c == '/' || c == '\n' || c == EOF) {
+			ok = read_stream_row(&stream, row++, stream.row,
+					length);
+			length = 0;
+			if (c == EOF) {
+				break;
+			}
+		} else if (! (ok = grow_array((void **) &stream.row, length,
+				&max_length, 1))) {
+			break;
+		} else {
+			stream.row[length++] = (char) c;
+		}
+	}
+	if (ok) {
+		last = stream.layers + stream.num_layers - 1;
+		for (s = 0; s < last->states.num_entries; s++) {
+			if (finished_state(last, s)) {
+				total += last->states.entries[s].count;
+				found = s;
+			}
+		}
+		if (count_only) {
+			printf("Solutions: %.0f\n", total);
+		} else if (found < 0) {
+			fprintf(stderr, stream.discarded
+					? "No solution found keeping %d rows\n"
+					: "No solution found\n",
+					STREAM_DEFER_BANDS * band);
+			ok = false;
+		} else {
+			write_layers(&stream, stream.num_layers - 1, found);
+			printf("\n");
+		}
+	}
+	for (s = 0; s < stream.num_layers; s++) {
+		free_layer(stream.layers + s);
+	}
+	free(stream.layers);
+	free(stream.path);
+	free(stream.live);
+	free(stream.seen);
+	free(stream.row);
+	free(stream.lastrow);
+	free(stream.cols);
+	free(stream.groups);
+	free(stream.labels);
+	free(stream.expects);
+	free(stream.ups);
+	free(stream.rights);
+	free(stream.downs);
+	free(stream.key);
+	return ok;
+}
+
+/** Options given in the command line. */
+typedef struct st_hoptions {
+	bool estimate, batch, interleave, pipeline, count, diagram, marginals;
+	bool async_output, lanes, stats, find_one, keep_phases, stream, sparse;
+	bool profile_islands, perf_counters, latency;
+	int probes, threads, split, samples, enumerate, flow_check;
+	int implications, cut_edges, lp, band_rows;
+	long long limit, restart_nodes, local_steps, latency_interval;
+	char *emit_jobs, *run_job, *edits, *trace;
+	char **merge_paths;
+	int num_merge_paths;
+	unsigned long long seed;
+	output_format format;
+	search_engine engine;
+	htracer *tracer;
+} hoptions;
+
+/** Histogram of positive values with buckets of logarithmic size: the values
+ * below 2 * HISTOGRAM_SUB_BUCKETS have their own bucket, and each power of
+ * two after them is split in HISTOGRAM_SUB_BUCKETS buckets, so a value is
+ * kept with a relative error below 1 / HISTOGRAM_SUB_BUCKETS (as HDR). */
+typedef struct st_hhistogram {
+	long long count, max;
+	long long buckets[HISTOGRAM_BUCKETS];
+} hhistogram;
+
+/** Histograms of the solve times (in nanoseconds) and of the nodes of the
+ * puzzles of each class of numbers of islands, and of all of them. */
+typedef struct st_hlatency {
+	hhistogram nanos[LATENCY_CLASSES + 1], nodes[LATENCY_CLASSES + 1];
+} hlatency;
+
+/** Returns the bucket of the histogram for the given value. */
+int histogram_bucket(long long value) {
+	int shift;
+	for (shift = 0; (value >> shift) >= 2 * HISTOGRAM_SUB_BUCKETS;
+			shift++);
+	return shift * HISTOGRAM_SUB_BUCKETS + (int) (value >> shift);
+}
+
+/** Returns the highest value kept in the given bucket of the histogram. */
+long long histogram_highest(int bucket) {
+	int shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+	if (shift <= 0) {
+		return bucket;
+	}
+	return (((long long) (bucket - shift * HISTOGRAM_SUB_BUCKETS) + 1)
+			<< shift) - 1;
+}
+
+void record_histogram(hhistogram *histogram, long long value) {
+	if (value < 0) {
+		value = 0;
+	}
+	histogram->buckets[histogram_bucket(value)]++;
+	histogram->count++;
+	if (histogram->max < value) {
+		histogram->max = value;
+	}
+}
+
+/** Returns the value below or equal to the given fraction of the values of
+ * the histogram, as the highest value of its bucket (but not above the
+ * maximum), or 0 if the histogram is empty. */
+long long histogram_percentile(hhistogram *histogram, double fraction) {
+	long long rank = (long long) ceil(fraction * histogram->count);
+	long long seen = 0, value;
+	int i;
+	if (rank < 1) {
+		rank = 1;
+	}
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		seen += histogram->buckets[i];
+		if (seen >= rank) {
+			value = histogram_highest(i);
+			return value < histogram->max ? value : histogram->max;
+		}
+	}
+	return 0;
+}
+
+/** Returns the class of a puzzle with the given islands: the first one for
+ * less than LATENCY_MIN_ISLANDS, and then one for each power of two. */
+int latency_class(int islands) {
+	int class = 0;
+	for (; islands >= LATENCY_MIN_ISLANDS && class < LATENCY_CLASSES - 1;
+			islands /= 2) {
+		class++;
+	}
+	return class;
+}
+
+/** Records the solve time and the nodes of a puzzle with the given islands
+ * in the histograms of its class and of all the puzzles. */
+void record_latency(hlatency *latency, int islands, long long nanos,
+		long long nodes) {
+	int class = latency_class(islands);
+	record_histogram(latency->nanos + class, nanos);
+	record_histogram(latency->nodes + class, nodes);
+	record_histogram(latency->nanos + LATENCY_CLASSES, nanos);
+	record_histogram(latency->nodes + LATENCY_CLASSES, nodes);
+}
+
+/** Prints the percentiles 50, 99 and 99.9 of the solve times (milliseconds)
+ * and of the nodes of each class of puzzles with any puzzle, and of all. */
+void print_latency(hlatency *latency, FILE *out) {
+	const double fractions[] = { 0.5, 0.99, 0.999 };
+	hhistogram *nanos, *nodes;
+	char islands[32];
+	int class, i, min = LATENCY_MIN_ISLANDS;
+	fprintf(out, "Latency of %lld puzzles:\n",
+			latency->nanos[LATENCY_CLASSES].count);
+	fprintf(out, "%-10s %8s %9s %9s %9s %9s %10s %10s %10s\n", "Islands",
+			"Puzzles", "p50 ms", "p99 ms", "p999 ms", "max ms",
+			"p50 nodes", "p99 nodes", "p999 nodes");
+	for (class = 0; class <= LATENCY_CLASSES; class++) {
+		nanos = latency->nanos + class;
+		nodes = latency->nodes + class;
+		if (class == 0) {
+			snprintf(islands, sizeof(islands), "<%d", min);
+		} else if (class < LATENCY_CLASSES - 1) {
+			snprintf(islands, sizeof(islands), "%d-%d", min,
+					2 * min - 1);
+			min *= 2;
+		} else if (class == LATENCY_CLASSES - 1) {
+			snprintf(islands, sizeof(islands), ">=%d", min);
+		} else {
+			snprintf(islands, sizeof(islands), "all");
+		}
+		if (nanos->count == 0) {
+			continue;
+		}
+		fprintf(out, "%-10s %8lld", islands, nanos->count);
+		for (i = 0; i < 3; i++) {
+			fprintf(out, " %9.3f", histogram_percentile(nanos,
+					fractions[i]) / 1e6);
+		}
+		fprintf(out, " %9.3f", nanos->max / 1e6);
+		for (i = 0; i < 3; i++) {
+			fprintf(out, " %10lld", histogram_percentile(nodes,
+					fractions[i]));
+		}
+		fprintf(out, "\n");
+	}
+}
+
+/** A puzzle of a batch, with its output once solved, and its islands (-1 if
+ * it is not valid), solve time and nodes. */
+typedef struct st_hpuzzle {
+	char *text;
+	char *output;
+	size_t outputsize;
+	int islands;
+	long long nanos, nodes;
+	bool done;
+} hpuzzle;
+
+/** Puzzles solved by several threads, which take the next puzzle of the
+ * order from the most to the least expensive to reduce the total time,
+ * because the expensive puzzles started at the end would finish late. */
+typedef struct st_hbatch {
+	hpuzzle *puzzles;
+	int num_puzzles;
+	int *order;
+	int next;
+	hoptions *options;
+	pthread_mutex_t mutex;
+	pthread_cond_t donecond;
+} hbatch;
+
+/** Solves the given puzzle writing the output in memory, or an empty output
+ * if the puzzle is not valid (the error is written to the standard error). */
+void solve_batch_puzzle(hpuzzle *puzzle, hstorage *storage,
+		hoptions *options, htrace *trace) {
+	hboard board;
+	FILE *out;
+	long long start = 0, begin = 0;
+	bool valid;
+	puzzle->output = NULL;
+	puzzle->outputsize = 0;
+	puzzle->islands = -1;
+	if ((out = open_memstream(&puzzle->output,
+			&puzzle->outputsize)) == NULL) {
+		perror("open_memstream");
+		return;
+	}
+	init_board_storage(&board, storage);
+	board.out = out;
+	board.count_only = options->count;
+	board.trace = trace;
+	if (trace != NULL || options->latency) {
+		begin = start = monotonic_nanos();
+	}
+	valid = read_islands_line(&board, puzzle->text);
+	if (trace != NULL) {
+		trace_span(trace, "read", start, -1, 1);
+		start = monotonic_nanos();
+	}
+	if (valid) {
+		set_output_format(&board, options->format);
+		solve_board(&board);
+	}
+	if (trace != NULL) {
+		trace_span(trace, "solve", start, -1, 1);
+	}
+	if (valid && options->latency) {
+		puzzle->islands = board.num_islands;
+		puzzle->nanos = monotonic_nanos() - begin;
+		puzzle->nodes = board.stats.nodes;
+	}
+	fclose(out);
+}
+
+void *run_batch_worker(void *arg) {
+	hbatch *batch = arg;
+	hstorage *storage;
+	hpuzzle *puzzle;
+	htrace *trace = NULL;
+	if ((storage = malloc(sizeof(hstorage))) == NULL) {
+		fprintf(stderr, "Not enough memory for a board\n");
+		exit(-1);
+	}
+	if (batch->options->tracer != NULL && (trace = add_trace(
+			batch->options->tracer, "batch worker")) == NULL) {
+		exit(-1);
+	}
+	for (;;) {
+		pthread_mutex_lock(&batch->mutex);
+		if (batch->next >= batch->num_puzzles) {
+			pthread_mutex_unlock(&batch->mutex);
+			break;
+		}
+		puzzle = batch->puzzles + batch->order[batch->next++];
+		pthread_mutex_unlock(&batch->mutex);
+		solve_batch_puzzle(puzzle, storage, batch->options, trace);
+		pthread_mutex_lock(&batch->mutex);
+		puzzle->done = true;
+		pthread_cond_broadcast(&batch->donecond);
+		pthread_mutex_unlock(&batch->mutex);
+	}
+	free(storage);
+	return NULL;
+}
+
+/** Reads the lines of the standard input as puzzles, skipping empty lines. */
+bool read_batch_puzzles(hbatch *batch) {
+	char *line = NULL;
+	size_t linesize = 0;
+	ssize_t length;
+	int max_puzzles = 0;
+	hpuzzle *puzzles;
+	batch->puzzles = NULL;
+	batch->num_puzzles = 0;
+	while ((length = getline(&line, &linesize, stdin)) != -1) {
+		while (length > 0 && (line[length - 1] == '\n'
+				|| line[length - 1] == '\r')) {
+			line[--length] = '\0';
+		}
+		if (length == 0) {
+			continue;
+		}
+		if (batch->num_puzzles == max_puzzles) {
+			max_puzzles = max_puzzles ? max_puzzles * 2 : 64;
+			puzzles = realloc(batch->puzzles,
+					max_puzzles * sizeof(hpuzzle));
+			if (puzzles == NULL) {
+				fprintf(stderr, "Not enough memory for %d "
+						"puzzles\n", max_puzzles);
+				free(line);
+				return false;
+			}
+			batch->puzzles = puzzles;
+		}
+		puzzles = batch->puzzles + batch->num_puzzles++;
+		puzzles->text = strdup(line);
+		puzzles->output = NULL;
+		puzzles->done = false;
+		if (puzzles->text == NULL) {
+			fprintf(stderr, "Not enough memory for a puzzle\n");
+			free(line);
+			return false;
+		}
+	}
+	free(line);
+	return true;
+}
+
+/** Estimated cost of the puzzle of a batch with the given position. */
+typedef struct st_hcost {
+	double cost;
+	int index;
+} hcost;
+
+/** Returns the number of islands of the text of a puzzle. */
+int count_text_islands(const char *text) {
+	int islands = 0;
+	for (; *text; text++) {
+		islands += *text > '0' && *text <= '9';
+	}
+	return islands;
+}
+
+/** Estimates the cost of each puzzle as its islands, adding the estimated
+ * nodes of its search if it has many islands. */
+void estimate_batch_costs(hbatch *batch, hcost *costs, hstorage *storage,
+		unsigned long long seed) {
+	int i;
+	hboard board;
+	hrandom rnd;
+	hestimate estimate;
+	init_random(&rnd, seed);
+	for (i = 0; i < batch->num_puzzles; i++) {
+		costs[i].index = i;
+		costs[i].cost = count_text_islands(batch->puzzles[i].text);
+		if (costs[i].cost < BATCH_PROBE_ISLANDS) {
+			continue;
+		}
+		init_board_storage(&board, storage);
+		if (read_islands_line(&board, batch->puzzles[i].text)) {
+			estimate_search_tree(&board, &rnd, BATCH_PROBES,
+					&estimate);
+			costs[i].cost += estimate.nodes;
+		}
+	}
+}
+
+/** Compares two costs of puzzles by decreasing cost and then by position. */
+int compare_puzzle_costs(const void *a, const void *b) {
+	const hcost *first = a, *second = b;
+	if (first->cost != second->cost) {
+		return first->cost < second->cost ? 1 : -1;
+	}
+	return first->index - second->index;
+}
+
+/** Frees the puzzles of the batch with their texts and outputs. */
+void free_batch_puzzles(hbatch *batch) {
+	int i;
+	for (i = 0; i < batch->num_puzzles; i++) {
+		free(batch->puzzles[i].text);
+		free(batch->puzzles[i].output);
+	}
+	free(batch->puzzles);
+}
+
+/** Solves one puzzle per line of the standard input using the number of
+ * threads of the options, writing the outputs in the same order of the input.*/
+bool solve_batch(hoptions *options) {
+	hbatch batch;
+	hstorage *storage = NULL;
+	hcost *costs = NULL;
+	pthread_t *threads = NULL;
+	hlatency *latency = NULL;
+	int i, started;
+	bool ok = true;
+	batch.order = NULL;
+	if (! read_batch_puzzles(&batch)) {
+		free_batch_puzzles(&batch);
+		return false;
+	}
+	if ((storage = malloc(sizeof(hstorage))) == NULL
+			|| (costs = malloc((batch.num_puzzles + 1)
+					* sizeof(hcost))) == NULL
+			|| (batch.order = malloc((batch.num_puzzles + 1)
+					* sizeof(int))) == NULL
+			|| (threads = malloc(options->threads
+					* sizeof(pthread_t))) == NULL) {
+		fprintf(stderr, "Not enough memory for the batch\n");
+		ok = false;
+	} else if (options->latency && (latency = calloc(1,
+			sizeof(hlatency))) == NULL) {
+		fprintf(stderr, "Not enough memory for the latencies\n");
+		ok = false;
+	} else {
+		estimate_batch_costs(&batch, costs, storage, options->seed);
+		qsort(costs, batch.num_puzzles, sizeof(hcost),
+				compare_puzzle_costs);
+		for (i = 0; i < batch.num_puzzles; i++) {
+			batch.order[i] = costs[i].index;
+		}
+	}
+	free(storage);
+	free(costs);
+	if (! ok) {
+		free(threads);
+		free(batch.order);
+		free(latency);
+		free_batch_puzzles(&batch);
+		return false;
+	}
+	batch.next = 0;
+	batch.options = options;
+	pthread_mutex_init(&batch.mutex, NULL);
+	pthread_cond_init(&batch.donecond, NULL);
+	for (started = 0; started < options->threads; started++) {
+		if (pthread_create(threads + started, NULL, run_batch_worker,
+				&batch) != 0) {
+			break;
+		}
+	}
+	if (started == 0) {
+		fprintf(stderr, "Cannot create threads\n");
+		pthread_mutex_destroy(&batch.mutex);
+		pthread_cond_destroy(&batch.donecond);
+		free(threads);
+		free(batch.order);
+		free(latency);
+		free_batch_puzzles(&batch);
+		return false;
+	}
+	for (i = 0; i < batch.num_puzzles; i++) {
+		pthread_mutex_lock(&batch.mutex);
+		while (! batch.puzzles[i].done) {
+			pthread_cond_wait(&batch.donecond, &batch.mutex);
+		}
+		pthread_mutex_unlock(&batch.mutex);
+		if (batch.puzzles[i].output != NULL) {
+			fwrite(batch.puzzles[i].output, 1,
+				batch.puzzles[i].outputsize, stdout);
+			free(batch.puzzles[i].output);
+		}
+		free(batch.puzzles[i].text);
+		if (latency != NULL && batch.puzzles[i].islands >= 0) {
+			record_latency(latency, batch.puzzles[i].islands,
+					batch.puzzles[i].nanos,
+					batch.puzzles[i].nodes);
+			if (options->latency_interval > 0 && (i + 1)
+					% options->latency_interval == 0
+					&& i + 1 < batch.num_puzzles) {
+				fflush(stdout);
+				print_latency(latency, stderr);
+			}
+		}
+	}
+	if (latency != NULL) {
+		fflush(stdout);
+		print_latency(latency, stderr);
+		free(latency);
+	}
+	for (i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	pthread_mutex_destroy(&batch.mutex);
+	pthread_cond_destroy(&batch.donecond);
+	free(threads);
+	free(batch.order);
+	free(batch.puzzles);
+	return true;
+}
+
+/** A puzzle being solved in slices, with its priority given in the input,
+ * the number of slices already run and the position in the input. */
+typedef struct st_htask {
+	int priority, slices, seq;
+	hstorage storage;
+	hboard board;
+	hsearch search;
+	FILE *out;
+	char *output;
+	size_t outputsize;
+} htask;
+
+/** Tasks waiting for a thread, ordered in a binary heap by priority,
+ * then by fewer slices run (so new puzzles go before long searches)
+ * and then by their position in the input. */
+typedef struct st_hscheduler {
+	htask **heap;
+	int num_tasks, max_tasks;
+	int active;
+	bool closed;
+	pthread_mutex_t mutex;
+	pthread_cond_t readycond;
+	pthread_mutex_t outmutex;
+} hscheduler;
+
+/** Returns true if the first task must run before the second one. */
+bool task_before(htask *a, htask *b) {
+	if (a->priority != b->priority) {
+		return a->priority > b->priority;
+	}
+	if (a->slices != b->slices) {
+		return a->slices < b->slices;
+	}
+	return a->seq < b->seq;
+}
+
+/** Inserts the task in the heap, that must have space for it. */
+void push_task(hscheduler *scheduler, htask *task) {
+	int pos = scheduler->num_tasks++, parent;
+	while (pos > 0) {
+		parent = (pos - 1) / 2;
+		if (! task_before(task, scheduler->heap[parent])) {
+			break;
+		}
+		scheduler->heap[pos] = scheduler->heap[parent];
+		pos = parent;
+	}
+	scheduler->heap[pos] = task;
+}
+
+/** Removes and returns the first task of the heap, that must not be empty. */
+htask *pop_task(hscheduler *scheduler) {
+	htask *first = scheduler->heap[0];
+	htask *last = scheduler->heap[--scheduler->num_tasks];
+	int pos = 0, child;
+	while ((child = 2 * pos + 1) < scheduler->num_tasks) {
+		if (child + 1 < scheduler->num_tasks && task_before(
+				scheduler->heap[child + 1],
+				scheduler->heap[child])) {
+			child++;
+		}
+		if (! task_before(scheduler->heap[child], last)) {
+			break;
+		}
+		scheduler->heap[pos] = scheduler->heap[child];
+		pos = child;
+	}
+	scheduler->heap[pos] = last;
+	return first;
+}
+
+/** Adds a task to the scheduler, growing the heap if needed. */
+bool schedule_task(hscheduler *scheduler, htask *task) {
+	htask **heap;
+	pthread_mutex_lock(&scheduler->mutex);
+	if (scheduler->num_tasks == scheduler->max_tasks) {
+		int max_tasks = scheduler->max_tasks
+				? scheduler->max_tasks * 2 : 64;
+		heap = realloc(scheduler->heap, max_tasks * sizeof(htask *));
+		if (heap == NULL) {
+			pthread_mutex_unlock(&scheduler->mutex);
+			fprintf(stderr, "Not enough memory for %d tasks\n",
+					max_tasks);
+			return false;
+		}
+		scheduler->heap = heap;
+		scheduler->max_tasks = max_tasks;
+	}
+	push_task(scheduler, task);
+	pthread_cond_signal(&scheduler->readycond);
+	pthread_mutex_unlock(&scheduler->mutex);
+	return true;
+}
+
+/** Writes the output of the finished task and releases it. */
+void finish_task(hscheduler *scheduler, htask *task) {
+	if (task->board.count_only) {
+		print_count(&task->board);
+	}
+	fclose(task->out);
+	pthread_mutex_lock(&scheduler->outmutex);
+	printf("Puzzle %d:\n", task->seq + 1);
+	fwrite(task->output, 1, task->outputsize, stdout);
+	fflush(stdout);
+	pthread_mutex_unlock(&scheduler->outmutex);
+	free(task->output);
+	free(task);
+}
+
+/** Runs one slice of the given task, returning true when it is finished. */
+bool run_task_slice(htask *task) {
+	search_status status;
+	long steps = SLICE_STEPS;
+	task->slices++;
+	while ((status = run_search(&task->search, &steps))
+			== SEARCH_SOLUTION) {
+		emit_solution(&task->board);
+	}
+	return status == SEARCH_FINISHED;
+}
+
+void *run_scheduler_worker(void *arg) {
+	hscheduler *scheduler = arg;
+	htask *task;
+	for (;;) {
+		pthread_mutex_lock(&scheduler->mutex);
+		while (scheduler->num_tasks == 0 && ! (scheduler->closed
+				&& scheduler->active == 0)) {
+			pthread_cond_wait(&scheduler->readycond,
+					&scheduler->mutex);
+		}
+		if (scheduler->num_tasks == 0) {
+			pthread_cond_broadcast(&scheduler->readycond);
+			pthread_mutex_unlock(&scheduler->mutex);
+			break;
+		}
+		task = pop_task(scheduler);
+		scheduler->active++;
+		pthread_mutex_unlock(&scheduler->mutex);
+		if (run_task_slice(task)) {
+			finish_task(scheduler, task);
+		} else if (! schedule_task(scheduler, task)) {
+			exit(-1);
+		}
+		pthread_mutex_lock(&scheduler->mutex);
+		scheduler->active--;
+		pthread_cond_broadcast(&scheduler->readycond);
+		pthread_mutex_unlock(&scheduler->mutex);
+	}
+	return NULL;
+}
+
+/** Creates the task of the puzzle of the given line, which can start with
+ * a priority followed by a colon (for example 5:2003010/0000302/...),
+ * or returns NULL if there is not enough memory (an invalid puzzle is
+ * solved as an empty board to keep one output per input line). */
+htask *new_task(const char *line, int seq, hoptions *options) {
+	htask *task;
+	const char *puzzle = line;
+	int priority = 0;
+	while (*puzzle >= '0' && *puzzle <= '9') {
+		puzzle++;
+	}
+	if (*puzzle == ':') {
+		priority = atoi(line);
+		puzzle++;
+	} else {
+		puzzle = line;
+	}
+	if ((task = malloc(sizeof(htask))) == NULL) {
+		fprintf(stderr, "Not enough memory for a puzzle\n");
+		return NULL;
+	}
+	task->priority = priority;
+	task->slices = 0;
+	task->seq = seq;
+	task->output = NULL;
+	task->outputsize = 0;
+	if ((task->out = open_memstream(&task->output,
+			&task->outputsize)) == NULL) {
+		perror("open_memstream");
+		free(task);
+		return NULL;
+	}
+	init_board_storage(&task->board, &task->storage);
+	task->board.out = task->out;
+	task->board.count_only = options->count;
+	if (! read_islands_line(&task->board, puzzle)) {
+		fprintf(stderr, "Invalid puzzle in line %d\n", seq + 1);
+		task->board.num_islands = 0;
+	}
+	set_output_format(&task->board, options->format);
+	if (! task->board.count_only) {
+		print_board(&task->board);
+	}
+	if (! valid_visited_matrix_size(&task->board)) {
+		task->board.num_islands = 0;
+	}
+	init_search(&task->search, &task->board, task->storage.startedpath,
+			MAX_ISLANDS);
+	return task;
+}
+
+/** Solves the puzzles of the lines of the standard input while they are read,
+ * running slices of their searches in the threads of the options, so the
+ * easy puzzles are not delayed by the long ones. Each output is written when
+ * its puzzle is finished, after a line with its position in the input. */
+bool solve_interleaved(hoptions *options) {
+	hscheduler scheduler;
+	pthread_t *threads;
+	htask *task;
+	char *line = NULL;
+	size_t linesize = 0;
+	ssize_t length;
+	int seq = 0, started;
+	bool ok = true;
+	if ((threads = malloc(options->threads * sizeof(pthread_t))) == NULL) {
+		fprintf(stderr, "Not enough memory for the threads\n");
+		return false;
+	}
+	scheduler.heap = NULL;
+	scheduler.num_tasks = scheduler.max_tasks = 0;
+	scheduler.active = 0;
+	scheduler.closed = false;
+	pthread_mutex_init(&scheduler.mutex, NULL);
+	pthread_cond_init(&scheduler.readycond, NULL);
+	pthread_mutex_init(&scheduler.outmutex, NULL);
+	for (started = 0; started < options->threads; started++) {
+		if (pthread_create(threads + started, NULL,
+				run_scheduler_worker, &scheduler) != 0) {
+			break;
+		}
+	}
+	if (started == 0) {
+		fprintf(stderr, "Cannot create threads\n");
+		return false;
+	}
+	while (ok && (length = getline(&line, &linesize, stdin)) != -1) {
+		if (length == 0 || line[0] == '\n' || line[0] == '\r') {
+			continue;
+		}
+		if ((task = new_task(line, seq++, options)) == NULL
+				|| ! schedule_task(&scheduler, task)) {
+			ok = false;
+		}
+	}
+	free(line);
+	pthread_mutex_lock(&scheduler.mutex);
+	scheduler.closed = true;
+	pthread_cond_broadcast(&scheduler.readycond);
+	pthread_mutex_unlock(&scheduler.mutex);
+	for (; started > 0; started--) {
+		pthread_join(threads[started - 1], NULL);
+	}
+	pthread_mutex_destroy(&scheduler.mutex);
+	pthread_cond_destroy(&scheduler.readycond);
+	pthread_mutex_destroy(&scheduler.outmutex);
+	free(scheduler.heap);
+	free(threads);
+	return ok;
+}
+
+/** Cell of a bounded queue, with the turn in which it can be used. */
+typedef struct st_hqueuecell {
+	atomic_size_t sequence;
+	void *data;
+} hqueuecell;
+
+/** Bounded queue of pointers for several producers and consumers without
+ * locks: each cell has a sequence number that tells whether it is free for
+ * the producer of the current turn or full for the consumer of the turn,
+ * and the positions to enqueue and dequeue are taken with compare-and-swap.
+ * The size of the queue must be a power of two. */
+typedef struct st_hqueue {
+	hqueuecell *cells;
+	size_t mask;
+	atomic_size_t enqueuepos, dequeuepos;
+} hqueue;
+
+bool init_queue(hqueue *queue, size_t size) {
+	size_t i;
+	if ((queue->cells = malloc(size * sizeof(hqueuecell))) == NULL) {
+		fprintf(stderr, "Not enough memory for a queue\n");
+		return false;
+	}
+	for (i = 0; i < size; i++) {
+		atomic_init(&queue->cells[i].sequence, i);
+		queue->cells[i].data = NULL;
+	}
+	queue->mask = size - 1;
+	atomic_init(&queue->enqueuepos, 0);
+	atomic_init(&queue->dequeuepos, 0);
+	return true;
+}
+
+/** Adds the pointer to the queue, or returns false if the queue is full. */
+bool try_enqueue(hqueue *queue, void *data) {
+	hqueuecell *cell;
+	size_t pos = atomic_load_explicit(&queue->enqueuepos,
+			memory_order_relaxed);
+	long turn;
+	for (;;) {
+		cell = queue->cells + (pos & queue->mask);
+		turn = (long) (atomic_load_explicit(&cell->sequence,
+				memory_order_acquire) - pos);
+		if (turn == 0) {
+			if (atomic_compare_exchange_weak_explicit(
+					&queue->enqueuepos, &pos, pos + 1,
+					memory_order_relaxed,
+					memory_order_relaxed)) {
+				break;
+			}
+		} else if (turn < 0) {
+			return false;
+		} else {
+			pos = atomic_load_explicit(&queue->enqueuepos,
+					memory_order_relaxed);
+		}
+	}
+	cell->data = data;
+	atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+	return true;
+}
+
+/** Takes the first pointer of the queue, or returns false if it is empty. */
+bool try_dequeue(hqueue *queue, void **data) {
+	hqueuecell *cell;
+	size_t pos = atomic_load_explicit(&queue->dequeuepos,
+			memory_order_relaxed);
+	long turn;
+	for (;;) {
+		cell = queue->cells + (pos & queue->mask);
+		turn = (long) (atomic_load_explicit(&cell->sequence,
+				memory_order_acquire) - (pos + 1));
+		if (turn == 0) {
+			if (atomic_compare_exchange_weak_explicit(
+					&queue->dequeuepos, &pos, pos + 1,
+					memory_order_relaxed,
+					memory_order_relaxed)) {
+				break;
+			}
+		} else if (turn < 0) {
+			return false;
+		} else {
+			pos = atomic_load_explicit(&queue->dequeuepos,
+					memory_order_relaxed);
+		}
+	}
+	*data = cell->data;
+	atomic_store_explicit(&cell->sequence, pos + queue->mask + 1,
+			memory_order_release);
+	return true;
+}
+
+/** Adds the pointer to the queue, waiting while it is full (backpressure). */
+void enqueue(hqueue *queue, void *data) {
+	int attempts = 0;
+	while (! try_enqueue(queue, data)) {
+		wait_queue(&attempts);
+	}
+}
+
+/** Takes the first pointer of the queue, waiting while it is empty. */
+void *dequeue(hqueue *queue) {
+	void *data;
+	int attempts = 0;
+	while (! try_dequeue(queue, &data)) {
+		wait_queue(&attempts);
+	}
+	return data;
+}
+
+/** Preallocated board of the pipeline, reused for puzzle after puzzle. */
+typedef struct st_hslot {
+	hstorage storage;
+	hboard board;
+	char *line, *output;
+	size_t linesize, outputsize;
+	long long seq;
+	bool valid;
+} hslot;
+
+/** Pipeline of a reader thread that parses puzzles into free slots,
+ * solver threads and a writer thread that writes the outputs in order,
+ * connected by bounded queues. As the slots are only freed when their
+ * outputs are written, the memory used does not grow with the input. */
+typedef struct st_hpipeline {
+	hslot *slots;
+	int num_slots, num_solvers;
+	hqueue freeslots, parsed, solved;
+	hoptions *options;
+} hpipeline;
+
+void *run_pipeline_reader(void *arg) {
+	hpipeline *pipeline = arg;
+	hslot *slot;
+	ssize_t length;
+	long long seq = 0, start = 0;
+	int i;
+	htrace *trace = NULL;
+	if (pipeline->options->tracer != NULL
+			&& (trace = add_trace(pipeline->options->tracer,
+			"pipeline reader")) == NULL) {
+		exit(-1);
+	}
+	for (;;) {
+		slot = dequeue(&pipeline->freeslots);
+		do {
+			length = getline(&slot->line, &slot->linesize, stdin);
+		} while (length > 0 && (slot->line[0] == '\n'
+				|| slot->line[0] == '\r'));
+		if (length < 1) {
+			break;
+		}
+		slot->seq = seq++;
+		init_board_storage(&slot->board, &slot->storage);
+		slot->board.count_only = pipeline->options->count;
+		slot->board.trace = trace;
+		if (trace != NULL) {
+			start = monotonic_nanos();
+		}
+		slot->valid = read_islands_line(&slot->board, slot->line);
+		if (trace != NULL) {
+			trace_span(trace, "read", start, -1, 1);
+		}
+		if (! slot->valid) {
+			fprintf(stderr, "Invalid puzzle number %lld\n", seq);
+		}
+		set_output_format(&slot->board, pipeline->options->format);
+		enqueue(&pipeline->parsed, slot);
+	}
+	for (i = 0; i < pipeline->num_solvers; i++) {
+		enqueue(&pipeline->parsed, NULL);
+	}
+	return NULL;
+}
+
+void *run_pipeline_solver(void *arg) {
+	hpipeline *pipeline = arg;
+	hslot *slot;
+	FILE *out;
+	long long start = 0;
+	htrace *trace = NULL;
+	if (pipeline->options->tracer != NULL
+			&& (trace = add_trace(pipeline->options->tracer,
+			"pipeline solver")) == NULL) {
+		exit(-1);
+	}
+	while ((slot = dequeue(&pipeline->parsed)) != NULL) {
+		slot->output = NULL;
+		slot->outputsize = 0;
+		if (slot->valid) {
+			if ((out = open_memstream(&slot->output,
+					&slot->outputsize)) == NULL) {
+				perror("open_memstream");
+				exit(-1);
+			}
+			slot->board.out = out;
+			slot->board.trace = trace;
+			if (trace != NULL) {
+				start = monotonic_nanos();
+			}
+			solve_board(&slot->board);
+			if (trace != NULL) {
+				trace_span(trace, "solve", start, -1, 1);
+			}
+			fclose(out);
+		}
+		enqueue(&pipeline->solved, slot);
+	}
+	enqueue(&pipeline->solved, NULL);
+	return NULL;
+}
+
+/** Writes the outputs in the order of the input: an output that arrives
+ * before its turn waits in the position of its sequence modulo the number
+ * of slots, which cannot be used by another slot until this one is freed. */
+void *run_pipeline_writer(void *arg) {
+	hpipeline *pipeline = arg;
+	hslot *slot, **waiting;
+	long long next = 0, start = 0;
+	int ended = 0, pos;
+	htrace *trace = NULL;
+	if (pipeline->options->tracer != NULL
+			&& (trace = add_trace(pipeline->options->tracer,
+			"pipeline writer")) == NULL) {
+		exit(-1);
+	}
+	if ((waiting = calloc(pipeline->num_slots, sizeof(hslot *))) == NULL) {
+		fprintf(stderr, "Not enough memory for the writer\n");
+		exit(-1);
+	}
+	while (ended < pipeline->num_solvers) {
+		if ((slot = dequeue(&pipeline->solved)) == NULL) {
+			ended++;
+			continue;
+		}
+		waiting[slot->seq % pipeline->num_slots] = slot;
+		while ((slot = waiting[pos = next % pipeline->num_slots])
+				!= NULL && slot->seq == next) {
+			waiting[pos] = NULL;
+			if (trace != NULL) {
+				start = monotonic_nanos();
+			}
+			fwrite(slot->output, 1, slot->outputsize, stdout);
+			if (trace != NULL) {
+				trace_span(trace, "output", start, -1, 1);
+			}
+			free(slot->output);
+			slot->output = NULL;
+			next++;
+			enqueue(&pipeline->freeslots, slot);
+		}
+	}
+	fflush(stdout);
+	free(waiting);
+	return NULL;
+}
+
+/** Writer of the solutions of a ring, which prints them in its own board with
+ * the same islands of the board of the search. */
+typedef struct st_hasyncwriter {
+	hring ring;
+	hstorage storage;
+	hboard board;
+	pthread_t thread;
+} hasyncwriter;
+
+/** Adds the islands of the source board to the empty destination board,
+ * which gets the same connections in the same order. */
+bool copy_islands(hboard *dst, hboard *src) {
+	int i;
+	hisland *island;
+	for (i = 0; i < src->num_islands; i++) {
+		island = src->islands + i;
+		if (! add_island(dst, island->row, island->col,
+				island->expectbridges)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Prints the solutions of the ring until it is closed and empty.
+ * The changed connections are marked as dirty for the delta format. */
+void *run_async_writer(void *arg) {
+	hasyncwriter *writer = arg;
+	hring *ring = &writer->ring;
+	hconnection *conn;
+	char *solution;
+	long tail = 0;
+	int attempts = 0, i;
+	for (;;) {
+		if (tail == atomic_load_explicit(&ring->head,
+				memory_order_acquire)) {
+			if (atomic_load(&ring->closed) && tail
+					== atomic_load(&ring->head)) {
+				break;
+			}
+			wait_queue(&attempts);
+			continue;
+		}
+		attempts = 0;
+		solution = ring->solutions
+				+ (tail % ring->size) * ring->num_connections;
+		for (i = 0; i < ring->num_connections; i++) {
+			conn = writer->board.connections + i;
+			if (conn->bridges != solution[i]) {
+				conn->bridges = solution[i];
+				mark_dirty(conn);
+			}
+		}
+		atomic_store_explicit(&ring->tail, ++tail,
+				memory_order_release);
+		emit_solution(&writer->board);
+	}
+	fflush(writer->board.out);
+	return NULL;
+}
+
+/** Starts a writer thread to print the solutions found in the board. */
+hasyncwriter *start_async_writer(hboard *board) {
+	hasyncwriter *writer;
+	if ((writer = malloc(sizeof(hasyncwriter))) == NULL
+			|| (writer->ring.solutions = malloc(ASYNC_RING_SOLUTIONS
+				* (board->num_connections + 1))) == NULL) {
+		fprintf(stderr, "Not enough memory for the writer\n");
+		free(writer);
+		return NULL;
+	}
+	writer->ring.size = ASYNC_RING_SOLUTIONS;
+	writer->ring.num_connections = board->num_connections;
+	atomic_init(&writer->ring.head, 0);
+	atomic_init(&writer->ring.tail, 0);
+	atomic_init(&writer->ring.closed, false);
+	init_board_storage(&writer->board, &writer->storage);
+	writer->board.out = board->out;
+	if (! copy_islands(&writer->board, board)) {
+		free(writer->ring.solutions);
+		free(writer);
+		return NULL;
+	}
+	set_output_format(&writer->board, board->format);
+	if (pthread_create(&writer->thread, NULL, run_async_writer,
+			writer) != 0) {
+		fprintf(stderr, "Cannot create threads\n");
+		free(writer->ring.solutions);
+		free(writer);
+		return NULL;
+	}
+	board->ring = &writer->ring;
+	return writer;
+}
+
+/** Waits for the writer to print all the solutions and releases it. */
+void stop_async_writer(hboard *board, hasyncwriter *writer) {
+	atomic_store(&writer->ring.closed, true);
+	pthread_join(writer->thread, NULL);
+	board->ring = NULL;
+	free(writer->ring.solutions);
+	free(writer);
+}
+
+/** Prints the empty board and then all the solutions found, which are
+ * printed by a writer thread so a slow output does not stop the search. */
+bool solve_board_async(hboard *board) {
+	hasyncwriter *writer;
+	if (board->count_only || board->num_islands == 0) {
+		return solve_board(board);
+	}
+	print_board(board);
+	if (! valid_visited_matrix_size(board)
+			|| (writer = start_async_writer(board)) == NULL) {
+		return false;
+	}
+	find_solutions_from_island(board, 0);
+	stop_async_writer(board, writer);
+	return true;
+}
+
+/** Returns the smallest power of two not smaller than the given number. */
+size_t power_of_two(size_t number) {
+	size_t power = 1;
+	while (power < number) {
+		power *= 2;
+	}
+	return power;
+}
+
+/** Buffer of the standard output of the pipeline, which must exist until
+ * the end of the program because the buffer of a stream cannot be changed
+ * after writing to it. */
+char pipeline_output_buffer[PIPELINE_OUTPUT_BUFFER];
+
+/** Solves one puzzle per line of the standard input, which can be unbounded,
+ * in a pipeline with a reader, the threads of the options and a writer. */
+bool solve_pipeline(hoptions *options) {
+	hpipeline pipeline;
+	pthread_t reader, writer, *solvers;
+	int i, started = 0;
+	size_t size;
+	pipeline.options = options;
+	pipeline.num_solvers = options->threads;
+	pipeline.num_slots = PIPELINE_SLOTS_PER_SOLVER * options->threads;
+	size = power_of_two(pipeline.num_slots + options->threads + 1);
+	pipeline.slots = calloc(pipeline.num_slots, sizeof(hslot));
+	solvers = malloc(options->threads * sizeof(pthread_t));
+	if (pipeline.slots == NULL || solvers == NULL
+			|| ! init_queue(&pipeline.freeslots, size)
+			|| ! init_queue(&pipeline.parsed, size)
+			|| ! init_queue(&pipeline.solved, size)) {
+		fprintf(stderr, "Not enough memory for the pipeline\n");
+		return false;
+	}
+	setvbuf(stdout, pipeline_output_buffer, _IOFBF,
+			PIPELINE_OUTPUT_BUFFER);
+	for (i = 0; i < pipeline.num_slots; i++) {
+		enqueue(&pipeline.freeslots, pipeline.slots + i);
+	}
+	if (pthread_create(&writer, NULL, run_pipeline_writer, &pipeline) != 0
+			|| pthread_create(&reader, NULL, run_pipeline_reader,
+				&pipeline) != 0) {
+		fprintf(stderr, "Cannot create threads\n");
+		return false;
+	}
+	for (; started < options->threads; started++) {
+		if (pthread_create(solvers + started, NULL,
+				run_pipeline_solver, &pipeline) != 0) {
+			fprintf(stderr, "Cannot create threads\n");
+			exit(-1);
+		}
+	}
+	pthread_join(reader, NULL);
+	for (i = 0; i < started; i++) {
+		pthread_join(solvers[i], NULL);
+	}
+	pthread_join(writer, NULL);
+	fflush(stdout);
+	for (i = 0; i < pipeline.num_slots; i++) {
+		free(pipeline.slots[i].line);
+	}
+	free(pipeline.freeslots.cells);
+	free(pipeline.parsed.cells);
+	free(pipeline.solved.cells);
+	free(pipeline.slots);
+	free(solvers);
+	return true;
+}
+
+/** Vector with the values of the same variable of several puzzles (lanes),
+ * so the operations on them are done at the same time with vector
+ * instructions (using the vector extension of GCC and Clang). */
+typedef signed char hlanevec __attribute__((vector_size(LANES)));
+
+/** Small puzzles solved together with one puzzle per lane, saving each
+ * variable of all lanes in one vector (structure of arrays). For each
+ * island and direction, the lanes have the index of the connection and of
+ * the island in that direction (or -1), and the vectors of the pending
+ * bridges of the island in that direction and if the connection is blocked
+ * by a crossing connection with bridges. The bridges of each connection and
+ * the bridges that must be added are saved in vectors too. */
+typedef struct st_hlanes {
+	int num_lanes, num_islands, num_connections;
+	hboard *boards[LANES];
+	signed char conns[LANE_MAX_ISLANDS][DIRECTIONS][LANES];
+	signed char neighbours[LANE_MAX_ISLANDS][DIRECTIONS][LANES];
+	hlanevec pend[LANE_MAX_ISLANDS];
+	hlanevec bridges[LANE_MAX_CONNECTIONS];
+	hlanevec dirbridges[LANE_MAX_ISLANDS][DIRECTIONS];
+	hlanevec nbpend[LANE_MAX_ISLANDS][DIRECTIONS];
+	hlanevec blocked[LANE_MAX_ISLANDS][DIRECTIONS];
+	hlanevec need[LANE_MAX_ISLANDS][DIRECTIONS];
+	hlanevec failed;
+} hlanes;
+
+/** Returns true if the board is small enough to be solved in a lane. */
+bool fits_in_lane(hboard *board) {
+	return board->num_islands <= LANE_MAX_ISLANDS
+			&& board->num_connections <= LANE_MAX_CONNECTIONS;
+}
+
+/** Returns the index of the connection whose number of bridges is given. */
+int bridges_connection(hboard *board, char *pbridges) {
+	return (int) ((hconnection *) (pbridges
+		- offsetof(hconnection, bridges)) - board->connections);
+}
+
+/** Loads the boards (which must fit in a lane) in the lanes. */
+void load_lanes(hlanes *lanes, hboard **boards, int num_boards) {
+	int i, dir, lane;
+	hboard *board;
+	hisland *island;
+	memset(lanes, 0, sizeof(hlanes));
+	memset(lanes->conns, -1, sizeof(lanes->conns));
+	memset(lanes->neighbours, -1, sizeof(lanes->neighbours));
+	lanes->num_lanes = num_boards;
+	for (lane = 0; lane < num_boards; lane++) {
+		board = lanes->boards[lane] = boards[lane];
+		if (lanes->num_islands < board->num_islands) {
+			lanes->num_islands = board->num_islands;
+		}
+		if (lanes->num_connections < board->num_connections) {
+			lanes->num_connections = board->num_connections;
+		}
+		for (i = 0; i < board->num_islands; i++) {
+			island = board->islands + i;
+			lanes->pend[i][lane] = island->pendbridges;
+			for (dir = 0; dir < DIRECTIONS; dir++) {
+				if (island->connections[dir]
+						== board->out_connection) {
+					continue;
+				}
+				lanes->conns[i][dir][lane] = (signed char)
+					(island->connections[dir]
+						- board->connections);
+				lanes->neighbours[i][dir][lane] = (signed char)
+					island_index(board,
+						island->islands[dir]);
+			}
+		}
+	}
+}
+
+/** Returns true if the connection is crossed by a connection with bridges
+ * in the given lane. */
+bool crossed_in_lane(hlanes *lanes, hboard *board, int conn, int lane) {
+	hcrosselem *cross;
+	for (cross = board->connections[conn].firstcross; cross != NULL;
+			cross = cross->nextcross) {
+		if (lanes->bridges[bridges_connection(board,
+				cross->pbridges)][lane]) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/** Gathers for each island and direction of each lane the bridges of the
+ * connection, the pending bridges of the island in that direction and if
+ * the connection is blocked, and marks the lanes with crossing bridges
+ * as failed. This is the part that cannot be done with vectors because
+ * each lane has different connections. */
+void gather_lanes(hlanes *lanes) {
+	int i, dir, lane, conn;
+	hboard *board;
+	for (lane = 0; lane < lanes->num_lanes; lane++) {
+		board = lanes->boards[lane];
+		for (i = 0; i < lanes->num_islands; i++) {
+			for (dir = 0; dir < DIRECTIONS; dir++) {
+				lanes->dirbridges[i][dir][lane] = 0;
+				lanes->nbpend[i][dir][lane] = 0;
+				lanes->blocked[i][dir][lane] = 0;
+				if ((conn = lanes->conns[i][dir][lane]) < 0) {
+					continue;
+				}
+				lanes->dirbridges[i][dir][lane] =
+					lanes->bridges[conn][lane];
+				lanes->nbpend[i][dir][lane] = lanes->pend[
+					lanes->neighbours[i][dir][lane]][lane];
+				if (crossed_in_lane(lanes, board, conn, lane)) {
+					lanes->blocked[i][dir][lane] = -1;
+				}
+				if (lanes->blocked[i][dir][lane]
+						&& lanes->bridges[conn][lane]) {
+					lanes->failed[lane] = -1;
+				}
+			}
+		}
+	}
+}
+
+/** Returns the minimum of each pair of values of the vectors. */
+hlanevec min_lanes(hlanevec a, hlanevec b) {
+	hlanevec less = a < b;
+	return (a & less) | (b & ~less);
+}
+
+/** Computes in all the lanes at the same time the bridges that must be added
+ * to each connection of each island because the other connections of the
+ * island cannot take all its pending bridges, and marks the lanes where an
+ * island needs more bridges than its connections can take as failed. */
+void deduce_lanes(hlanes *lanes) {
+	hlanevec zero = { 0 }, two = zero + MAX_CONNECTION_BRIDGES;
+	hlanevec cap[DIRECTIONS], total, need;
+	int i, dir;
+	for (i = 0; i < lanes->num_islands; i++) {
+		total = zero;
+		for (dir = 0; dir < DIRECTIONS; dir++) {
+			cap[dir] = min_lanes(min_lanes(two
+					- lanes->dirbridges[i][dir],
+					lanes->pend[i]), lanes->nbpend[i][dir]);
+			cap[dir] &= ~lanes->blocked[i][dir];
+			cap[dir] &= cap[dir] > zero;
+			total += cap[dir];
+		}
+		lanes->failed |= (lanes->pend[i] > total)
+				| (lanes->pend[i] < zero);
+		for (dir = 0; dir < DIRECTIONS; dir++) {
+			need = lanes->pend[i] - (total - cap[dir]);
+			lanes->need[i][dir] = need & (need > zero);
+		}
+	}
+}
+
+/** Adds in each lane not failed the bridges deduced in both islands of each
+ * connection, returning true if any bridge was added. */
+bool scatter_lanes(hlanes *lanes) {
+	int i, dir, lane, conn, other, add;
+	bool changed = false;
+	for (lane = 0; lane < lanes->num_lanes; lane++) {
+		if (lanes->failed[lane]) {
+			continue;
+		}
+		for (i = 0; i < lanes->num_islands; i++) {
+			for (dir = RIGHT; dir <= DOWN; dir++) {
+				if ((conn = lanes->conns[i][dir][lane]) < 0) {
+					continue;
+				}
+				other = lanes->neighbours[i][dir][lane];
+				/* opposite of RIGHT is LEFT, of DOWN is UP */
+				add = lanes->need[i][dir][lane];
+				if (add < lanes->need[other]
+						[DIRECTIONS - 1 - dir][lane]) {
+					add = lanes->need[other]
+						[DIRECTIONS - 1 - dir][lane];
+				}
+				if (add > 0) {
+					lanes->bridges[conn][lane] += add;
+					lanes->pend[i][lane] -= add;
+					lanes->pend[other][lane] -= add;
+					changed = true;
+				}
+			}
+		}
+	}
+	return changed;
+}
+
+/** Adds the bridges that can be deduced in all the lanes in lockstep,
+ * until no more bridges can be added or the given maximum of steps. */
+void propagate_lanes(hlanes *lanes, int max_steps) {
+	do {
+		gather_lanes(lanes);
+		deduce_lanes(lanes);
+	} while (scatter_lanes(lanes) && --max_steps > 0);
+	gather_lanes(lanes);
+}
+
+/** Returns true if all the islands of the lane have all their bridges. */
+bool completed_lane(hlanes *lanes, int lane) {
+	int i;
+	for (i = 0; i < lanes->num_islands; i++) {
+		if (lanes->pend[i][lane]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Solves the board of the lane: if the propagation failed there are no
+ * solutions, if it completed all the islands its bridges are the only
+ * possible solution (all of them were deduced) if it is connected,
+ * and otherwise the board is solved by the usual search. */
+bool solve_lane(hlanes *lanes, int lane) {
+	hboard *board = lanes->boards[lane];
+	int conn;
+	if (! lanes->failed[lane] && ! completed_lane(lanes, lane)) {
+		return solve_board(board);
+	}
+	if (! board->count_only) {
+		print_board(board);
+	}
+	if (! valid_visited_matrix_size(board)) {
+		return false;
+	}
+	if (! lanes->failed[lane]) {
+		for (conn = 0; conn < board->num_connections; conn++) {
+			board->connections[conn].bridges =
+				lanes->bridges[conn][lane];
+		}
+		if (check_connected_solution(board)) {
+			emit_solution(board);
+		}
+	}
+	if (board->count_only) {
+		print_count(board);
+	}
+	return true;
+}
+
+/** Solves one puzzle per line of the standard input, solving the small ones
+ * in groups of LANES puzzles whose deductions are made at the same time
+ * with vector instructions, and the rest (and the puzzles that cannot be
+ * completed by deductions) with the usual search. */
+bool solve_lanes(hoptions *options) {
+	hbatch batch;
+	hstorage *storages;
+	hboard boards[LANES], *lanesboards[LANES];
+	hlanes *lanes;
+	int first, i, num_boards;
+	bool valid[LANES];
+	if (! read_batch_puzzles(&batch)) {
+		return false;
+	}
+	storages = malloc(LANES * sizeof(hstorage));
+	lanes = malloc(sizeof(hlanes));
+	if (storages == NULL || lanes == NULL) {
+		fprintf(stderr, "Not enough memory for the lanes\n");
+		return false;
+	}
+	for (first = 0; first < batch.num_puzzles; first += LANES) {
+		num_boards = 0;
+		for (i = 0; i < LANES && first + i < batch.num_puzzles; i++) {
+			init_board_storage(boards + i, storages + i);
+			boards[i].count_only = options->count;
+			valid[i] = read_islands_line(boards + i,
+					batch.puzzles[first + i].text);
+			if (valid[i]) {
+				set_output_format(boards + i, options->format);
+			}
+			if (valid[i] && fits_in_lane(boards + i)) {
+				lanesboards[num_boards++] = boards + i;
+			}
+		}
+		load_lanes(lanes, lanesboards, num_boards);
+		propagate_lanes(lanes, LANE_MAX_STEPS);
+		for (i = 0, num_boards = 0; i < LANES
+				&& first + i < batch.num_puzzles; i++) {
+			if (valid[i] && fits_in_lane(boards + i)) {
+				solve_lane(lanes, num_boards++);
+			} else if (valid[i]) {
+				solve_board(boards + i);
+			}
+			free(batch.puzzles[first + i].text);
+		}
+	}
+	free(lanes);
+	free(storages);
+	free(batch.puzzles);
+	return true;
+}
+
+/** State of the local search of one solution: the bridges of every
+ * connection are set at once (never in two crossing connections) and then
+ * changed one connection at a time, accepting the changes that reduce the
+ * cost and some that increase it (simulated annealing). The cost is the sum
+ * of the differences between the bridges and the expected bridges of each
+ * island, and when there are no differences, the number of groups of islands
+ * minus one, so the groups are only counted in the few states without
+ * differences. The changes of a move are saved to undo it if rejected.
+ * The islands with differences (wrong) are kept in a list, because most
+ * changes are made in their connections. To search paths between them,
+ * each island has two states (the next change adds or deletes a bridge)
+ * that save the previous state of the path. The maximum of bridges of each
+ * connection avoids the groups of two islands (1 - 1 or 2 = 2) that are
+ * found by the moves much more often than bigger groups. */
+typedef struct st_hlocal {
+	hboard *board;
+	hrandom rnd;
+	int *degrees, *stack, *group, *wrong, *wrongpos, *previous, *via;
+	hconnection **changed;
+	char *oldbridges, *maxbridges;
+	int num_changed, violation, num_wrong;
+} hlocal;
+
+/** Counts the groups of islands connected by bridges. */
+int count_local_groups(hlocal *local) {
+	hboard *board = local->board;
+	hisland *island;
+	int groups = 0, i, v, top, dir, w;
+	for (i = 0; i < board->num_islands; i++) {
+		local->group[i] = -1;
+	}
+	for (i = 0; i < board->num_islands; i++) {
+		if (local->group[i] > -1) {
+			continue;
+		}
+		local->group[i] = groups;
+		local->stack[0] = i;
+		top = 1;
+		while (top > 0) {
+			v = local->stack[--top];
+			island = board->islands + v;
+			for (dir = 0; dir < DIRECTIONS; dir++) {
+				if (! island->connections[dir]->bridges) {
+					continue;
+				}
+				w = island_index(board, island->islands[dir]);
+				if (local->group[w] < 0) {
+					local->group[w] = groups;
+					local->stack[top++] = w;
+				}
+			}
+		}
+		groups++;
+	}
+	return groups;
+}
+
+/** Returns the cost of the current bridges. */
+int local_cost(hlocal *local) {
+	if (local->violation) {
+		return local->violation;
+	}
+	return count_local_groups(local) - 1;
+}
+
+/** Changes the bridges of the connection, updating the degrees of its
+ * islands and the violation. */
+void set_local_bridges(hlocal *local, hconnection *connection, int bridges) {
+	hboard *board = local->board;
+	int ends[2], k, i, expected, before;
+	ends[0] = connection_end(board, connection, true);
+	ends[1] = connection_end(board, connection, false);
+	for (k = 0; k < 2; k++) {
+		i = ends[k];
+		expected = board->islands[i].expectbridges;
+		before = abs(local->degrees[i] - expected);
+		local->degrees[i] += bridges - connection->bridges;
+		local->violation += abs(local->degrees[i] - expected) - before;
+		if (local->degrees[i] == expected && before) {
+			local->wrong[local->wrongpos[i]] =
+					local->wrong[--local->num_wrong];
+			local->wrongpos[local->wrong[local->num_wrong]] =
+					local->wrongpos[i];
+		} else if (local->degrees[i] != expected && ! before) {
+			local->wrongpos[i] = local->num_wrong;
+			local->wrong[local->num_wrong++] = i;
+		}
+	}
+	connection->bridges = bridges;
+}
+
+/** Changes the bridges of the connection as part of the current move,
+ * saving its old bridges to undo it. */
+void change_local_bridges(hlocal *local, hconnection *connection,
+		int bridges) {
+	local->changed[local->num_changed] = connection;
+	local->oldbridges[local->num_changed++] = connection->bridges;
+	set_local_bridges(local, connection, bridges);
+}
+
+/** Sets the bridges of the connection as part of the current move, deleting
+ * the bridges of the connections crossing it if it gets bridges. */
+void move_local_bridges(hlocal *local, hconnection *connection, int bridges) {
+	hcrosselem *cross;
+	for (cross = connection->firstcross; bridges && cross != NULL;
+			cross = cross->nextcross) {
+		if (*(cross->pbridges)) {
+			change_local_bridges(local,
+					bridges_owner(cross->pbridges), 0);
+		}
+	}
+	change_local_bridges(local, connection, bridges);
+}
+
+/** Returns the change of bridges of the next connection of a path state. */
+int local_path_sign(int state) {
+	return state % 2 ? -1 : 1;
+}
+
+/** Changes the connections of the path found until the given state. */
+void apply_local_path(hlocal *local, int state) {
+	hconnection *conn;
+	for (; local->previous[state] > -1; state = local->previous[state]) {
+		conn = local->board->connections + local->via[state];
+		move_local_bridges(local, conn, conn->bridges
+				+ local_path_sign(local->previous[state]));
+	}
+}
+
+/** Searches in breadth first order a path from the given wrong island to
+ * another wrong island whose connections alternately get and lose a bridge
+ * (so the islands inside the path keep their bridges) and changes them,
+ * fixing both ends. The path does not add bridges to crossed connections.*/
+void move_local_path(hlocal *local, int start) {
+	hboard *board = local->board;
+	hisland *island;
+	hconnection *conn;
+	int n = board->num_islands, head = 0, tail = 0, state, v, w, c, dir;
+	int sign, bridges, need;
+	for (state = 0; state < 2 * n; state++) {
+		local->previous[state] = -2;
+	}
+	state = 2 * start + (local->degrees[start]
+			> board->islands[start].expectbridges);
+	local->previous[state] = -1;
+	local->stack[tail++] = state;
+	while (head < tail) {
+		state = local->stack[head++];
+		sign = local_path_sign(state);
+		island = board->islands + state / 2;
+		for (dir = 0; dir < DIRECTIONS; dir++) {
+			conn = island->connections[dir];
+			if (conn == board->out_connection) {
+				continue;
+			}
+			c = connection_index(board, conn);
+			bridges = conn->bridges + sign;
+			if (bridges < 0 || bridges > local->maxbridges[c]
+					|| (sign > 0
+					&& crossed_connection(conn))) {
+				continue;
+			}
+			v = island_index(board, island->islands[dir]);
+			w = 2 * v + (sign > 0);
+			if (local->previous[w] != -2) {
+				continue;
+			}
+			local->previous[w] = state;
+			local->via[w] = c;
+			need = board->islands[v].expectbridges
+					- local->degrees[v];
+			if (v != start && sign * need > 0) {
+				apply_local_path(local, w);
+				return;
+			}
+			local->stack[tail++] = w;
 		}
 	}
 }
 
-bool valid_visited_matrix_size(hboard *board) {
-	if (board->max_visited_size < board->rows * board->cols) {
-		fprintf(stderr, "Maximum visited islands size too small: %d\n",
-				board->max_visited_size);
+/** Joins two groups of islands adding a bridge to a connection between them
+ * and then fixing its islands with a path of changes. */
+void move_local_join(hlocal *local) {
+	hboard *board = local->board;
+	hconnection *conn;
+	int a, b, tries;
+	count_local_groups(local);
+	for (tries = 0; tries < board->num_connections; tries++) {
+		conn = board->connections + random_below(&local->rnd,
+				board->num_connections);
+		a = connection_end(board, conn, true);
+		b = connection_end(board, conn, false);
+		if (local->group[a] != local->group[b]
+				&& conn->bridges < local->maxbridges[
+				connection_index(board, conn)]
+				&& ! crossed_connection(conn)) {
+			move_local_bridges(local, conn, conn->bridges + 1);
+			move_local_path(local, a);
+			return;
+		}
+	}
+}
+
+/** Makes a random move: usually it changes by one bridge a connection of an
+ * island with differences, towards its expected bridges, and sometimes also
+ * another connection of the other island by the opposite difference, so the
+ * difference moves to a third island; or if there are no differences, it
+ * joins two groups of islands; otherwise it changes any connection. */
+void make_local_move(hlocal *local) {
+	hboard *board = local->board;
+	hisland *island;
+	hconnection *conn, *next;
+	int i, dir, difference, bridges;
+	local->num_changed = 0;
+	if (local->num_wrong == 0 && random_unit(&local->rnd) < LOCAL_JOIN) {
+		move_local_join(local);
+		return;
+	}
+	if (local->num_wrong == 0 || random_unit(&local->rnd) >= LOCAL_FOCUS) {
+		i = random_below(&local->rnd, board->num_connections);
+		if (local->maxbridges[i]) {
+			conn = board->connections + i;
+			bridges = conn->bridges + 1 + random_below(&local->rnd,
+					local->maxbridges[i]);
+			move_local_bridges(local, conn,
+					bridges % (local->maxbridges[i] + 1));
+		}
+		return;
+	}
+	i = local->wrong[random_below(&local->rnd, local->num_wrong)];
+	if (random_unit(&local->rnd) < LOCAL_PATH) {
+		move_local_path(local, i);
+		return;
+	}
+	island = board->islands + i;
+	do {
+		dir = random_below(&local->rnd, DIRECTIONS);
+	} while (island->connections[dir] == board->out_connection);
+	conn = island->connections[dir];
+	difference = local->degrees[i] > island->expectbridges ? -1 : 1;
+	bridges = conn->bridges + difference;
+	if (bridges < 0 || bridges > local->maxbridges[
+			connection_index(board, conn)]) {
+		return;
+	}
+	move_local_bridges(local, conn, bridges);
+	if (random_unit(&local->rnd) < LOCAL_SHIFT) {
+		next = island->islands[dir]->connections[random_below(
+				&local->rnd, DIRECTIONS)];
+		bridges = next->bridges - difference;
+		if (next != board->out_connection && next != conn
+				&& bridges >= 0 && bridges <= local->maxbridges[
+				connection_index(board, next)]) {
+			move_local_bridges(local, next, bridges);
+		}
+	}
+}
+
+/** Undoes the changes of the last move, in reverse order. */
+void undo_local_move(hlocal *local) {
+	while (local->num_changed > 0) {
+		local->num_changed--;
+		set_local_bridges(local, local->changed[local->num_changed],
+				local->oldbridges[local->num_changed]);
+	}
+}
+
+/** Returns the maximum of bridges of the connection in the local search:
+ * none between two islands of 1 bridge and one between two islands of 2
+ * bridges, because they would be a group of two islands. */
+int local_max_bridges(hboard *board, hconnection *connection) {
+	int expect1 = pending_island(connection->ppendbridges1)->expectbridges;
+	int expect2 = pending_island(connection->ppendbridges2)->expectbridges;
+	if (board->num_islands > 2 && expect1 == expect2
+			&& expect1 <= MAX_CONNECTION_BRIDGES) {
+		return expect1 - 1;
+	}
+	return MAX_CONNECTION_BRIDGES;
+}
+
+/** Searches bridges of cost 0 for up to the given steps, starting with random
+ * bridges. Returns true if they are found (then they are in the board). */
+bool run_local_search(hlocal *local, long long max_steps) {
+	hboard *board = local->board;
+	double temperature = LOCAL_TEMPERATURE;
+	long long step;
+	int cost, newcost, c, m = board->num_connections;
+	local->violation = 0;
+	local->num_wrong = 0;
+	for (c = 0; c < board->num_islands; c++) {
+		local->degrees[c] = 0;
+		local->violation += board->islands[c].expectbridges;
+		local->wrongpos[c] = local->num_wrong;
+		local->wrong[local->num_wrong++] = c;
+	}
+	for (c = 0; c < m; c++) {
+		local->maxbridges[c] = local_max_bridges(board,
+				board->connections + c);
+	}
+	for (c = 0; c < m; c++) {
+		local->num_changed = 0;
+		move_local_bridges(local, board->connections + c,
+				random_below(&local->rnd,
+				local->maxbridges[c] + 1));
+	}
+	cost = local_cost(local);
+	for (step = 0; step < max_steps && cost > 0; step++) {
+		make_local_move(local);
+		newcost = local_cost(local);
+		if (newcost <= cost || random_unit(&local->rnd)
+				< exp((cost - newcost) / temperature)) {
+			cost = newcost;
+		} else {
+			undo_local_move(local);
+		}
+		if ((step + 1) % m == 0) {
+			temperature *= LOCAL_COOLING;
+			if (temperature < LOCAL_MIN_TEMPERATURE) {
+				temperature = LOCAL_TEMPERATURE;
+			}
+		}
+		board->stats.local_steps++;
+	}
+	return cost == 0;
+}
+
+/** Returns true if an island has no connection to build its bridges, so
+ * the moves of the local search could not change it. */
+bool isolated_island(hboard *board) {
+	hisland *island;
+	int i, dir;
+	for (i = 0; i < board->num_islands; i++) {
+		island = board->islands + i;
+		for (dir = 0; dir < DIRECTIONS && island->connections[dir]
+				== board->out_connection; dir++);
+		if (dir == DIRECTIONS) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/** Finds one solution of the board by local search, with the given seed
+ * and maximum of steps, printing the empty board and the solution (or only
+ * the number of solutions found if the board is only counting them). */
+bool solve_board_local(hboard *board, unsigned long long seed,
+		long long max_steps) {
+	hlocal local;
+	int n = board->num_islands, i;
+	bool solved = true;
+	if (! board->count_only) {
+		print_board(board);
+	}
+	if (n == 0) {
+		return true;
+	}
+	if (! valid_visited_matrix_size(board)) {
+		return false;
+	}
+	local.board = board;
+	init_random(&local.rnd, seed);
+	local.degrees = malloc(n * sizeof(int));
+	local.stack = malloc(2 * n * sizeof(int));
+	local.group = malloc(n * sizeof(int));
+	local.wrong = malloc(n * sizeof(int));
+	local.wrongpos = malloc(n * sizeof(int));
+	local.previous = malloc(2 * n * sizeof(int));
+	local.via = malloc(2 * n * sizeof(int));
+	local.changed = malloc((board->num_connections + 1)
+			* sizeof(hconnection *));
+	local.oldbridges = malloc(board->num_connections + 1);
+	local.maxbridges = malloc(board->num_connections + 1);
+	if (local.degrees == NULL || local.stack == NULL
+			|| local.group == NULL || local.wrong == NULL
+			|| local.wrongpos == NULL || local.previous == NULL
+			|| local.via == NULL || local.changed == NULL
+			|| local.oldbridges == NULL
+			|| local.maxbridges == NULL) {
+		fprintf(stderr, "Not enough memory for the local search\n");
+		solved = false;
+	} else if (board->num_connections == 0 || isolated_island(board)) {
+		fprintf(stderr, "No solution found\n");
+	} else if (run_local_search(&local, max_steps)) {
+		for (i = 0; i < n; i++) {
+			board->islands[i].pendbridges = 0;
+		}
+		if (check_connected_solution(board)) {
+			emit_solution(board);
+		}
+	} else {
+		fprintf(stderr, "No solution found in %lld steps\n", max_steps);
+	}
+	free(local.degrees);
+	free(local.stack);
+	free(local.group);
+	free(local.wrong);
+	free(local.wrongpos);
+	free(local.previous);
+	free(local.via);
+	free(local.changed);
+	free(local.oldbridges);
+	free(local.maxbridges);
+	if (solved && board->count_only) {
+		print_count(board);
+	}
+	return solved;
+}
+
+/** Reads the whole standard input into a string that must be freed. */
+char *read_input(void) {
+	char *text = NULL, *bigger;
+	size_t length = 0, capacity = 0, got;
+	do {
+		if (length + 1 >= capacity) {
+			capacity = capacity ? 2 * capacity : BUFSIZ;
+			if ((bigger = realloc(text, capacity)) == NULL) {
+				fprintf(stderr, "Not enough memory\n");
+				free(text);
+				return NULL;
+			}
+			text = bigger;
+		}
+		got = fread(text + length, 1, capacity - length - 1, stdin);
+		length += got;
+	} while (got > 0);
+	text[length] = '\0';
+	return text;
+}
+
+/** Finds one solution of the puzzle of the standard input by local search,
+ * with arrays sized from the input, so it can be much bigger than the
+ * puzzles of the other engines. */
+bool solve_local(hoptions *options) {
+	hboard board;
+	char *text, *p;
+	int islands = 0, rows = 1, cols = 0, col = 0;
+	bool solved;
+	if ((text = read_input()) == NULL) {
+		return false;
+	}
+	for (p = text; *p != '\0'; p++) {
+		if (*p == '/' || *p == '\n') {
+			rows++;
+			col = 0;
+		} else if (*p == '.' || (*p >= '0' && *p <= '9')) {
+			islands += *p > '0';
+			if (++col > cols) {
+				cols = col;
+			}
+		}
+	}
+	if (! init_board_arrays(&board, islands, 2 * islands,
+			2 * rows * cols, islands)) {
+		free(text);
+		return false;
+	}
+	board.count_only = options->count;
+	solved = read_islands_text(&board, text);
+	free(text);
+	if (solved) {
+		set_output_format(&board, options->format);
+		solved = solve_board_local(&board, options->seed,
+				options->local_steps);
+		if (options->stats) {
+			print_stats(&board);
+		}
+	}
+	free_board_arrays(&board);
+	return solved;
+}
+
+/** Returns the number of processors online, or 1 if it is not known. */
+int count_processors(void) {
+	long processors = sysconf(_SC_NPROCESSORS_ONLN);
+	return processors > 0 ? (int) processors : 1;
+}
+
+void print_usage(const char *name) {
+	fprintf(stderr, "Usage: %s [options] < puzzle\n", name);
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  --estimate    estimate the size of the search "
+			"instead of solving\n");
+	fprintf(stderr, "  --probes N    random descents of the estimation "
+			"(default %d)\n", DEFAULT_PROBES);
+	fprintf(stderr, "  --seed N      seed of the pseudo-random numbers "
+			"(default %d)\n", DEFAULT_SEED);
+	fprintf(stderr, "  --batch       solve one puzzle per input line\n");
+	fprintf(stderr, "  --interleave  solve one puzzle per input line "
+			"in slices\n");
+	fprintf(stderr, "  --pipeline    solve one puzzle per input line "
+			"while reading and writing\n");
+	fprintf(stderr, "  --lanes       solve one puzzle per input line, "
+			"the small ones in groups\n");
+	fprintf(stderr, "  --latency     print the percentiles of the solve "
+			"times of the batch by islands\n");
+	fprintf(stderr, "  --latency-interval N\n");
+	fprintf(stderr, "                print them also after every N "
+			"puzzles of the batch\n");
+	fprintf(stderr, "  --threads N   threads solving the puzzles "
+			"(default: processors)\n");
+	fprintf(stderr, "  --sparse      read the islands as "
+			"\"row col bridges\" triples in any order\n");
+	fprintf(stderr, "  --count       print only the number of solutions\n");
+	fprintf(stderr, "  --limit N     stop after finding N solutions\n");
+	fprintf(stderr, "  --find-one    find one solution in random orders "
+			"with restarts\n");
+	fprintf(stderr, "  --restart-nodes N\n");
+	fprintf(stderr, "                nodes multiplied by the Luby sequence "
+			"between restarts (default %d)\n",
+			DEFAULT_RESTART_NODES);
+	fprintf(stderr, "  --keep-phases try first after a restart the last "
+			"orderings tried\n");
+	fprintf(stderr, "  --async-output\n");
+	fprintf(stderr, "                print the solutions in another "
+			"thread while searching\n");
+	fprintf(stderr, "  --format=board|delta\n");
+	fprintf(stderr, "                print whole solutions or only "
+			"the changes from the previous\n");
+	fprintf(stderr, "  --engine=islands|topology|local|middle\n");
+	fprintf(stderr, "                search the bridges of each island, "
+			"or first which connections have them,\n");
+	fprintf(stderr, "                or one solution changing "
+			"connections at random,\n");
+	fprintf(stderr, "                or count the solutions of two "
+			"halves joined at a row\n");
+	fprintf(stderr, "  --stream      count the solutions or find one "
+			"reading the puzzle row by row\n");
+	fprintf(stderr, "  --band-rows N rows kept by --stream before "
+			"printing the bridges decided (default %d)\n",
+			DEFAULT_BAND_ROWS);
+	fprintf(stderr, "  --edits FILE  solve again after each "
+			"\"row col bridges\" edit of the file\n");
+	fprintf(stderr, "  --local-steps N\n");
+	fprintf(stderr, "                maximum of changes of the local "
+			"search (default %d)\n", DEFAULT_LOCAL_STEPS);
+	fprintf(stderr, "  --split N --emit-jobs DIR\n");
+	fprintf(stderr, "                write one job file per partial "
+			"solution of the first N islands\n");
+	fprintf(stderr, "  --run-job FILE\n");
+	fprintf(stderr, "                solve the job of the given file\n");
+	fprintf(stderr, "  --merge FILE...\n");
+	fprintf(stderr, "                merge the outputs of the jobs\n");
+	fprintf(stderr, "  --diagram     compile the solutions in a decision "
+			"diagram and count them\n");
+	fprintf(stderr, "  --sample N    print N uniformly random solutions "
+			"of the diagram\n");
+	fprintf(stderr, "  --marginals   print how often each connection "
+			"has bridges in the diagram\n");
+	fprintf(stderr, "  --enumerate N print the first N solutions "
+			"of the diagram\n");
+	fprintf(stderr, "  --flow-check N\n");
+	fprintf(stderr, "                prune the search when the pending "
+			"bridges cannot flow, every N islands\n");
+	fprintf(stderr, "  --implications N\n");
+	fprintf(stderr, "                prune the search when the presences "
+			"of bridges contradict, every N islands\n");
+	fprintf(stderr, "  --cut-edges N\n");
+	fprintf(stderr, "                prune the search when the islands "
+			"cannot be connected, every N islands\n");
+	fprintf(stderr, "  --lp N        prune the search when the linear "
+			"relaxation is infeasible, every N islands\n");
+	fprintf(stderr, "  --stats       print counters of the search "
+			"to the standard error\n");
+	fprintf(stderr, "  --trace FILE  write a Chrome trace of the phases "
+			"of the solving to the file\n");
+	fprintf(stderr, "  --profile-islands\n");
+	fprintf(stderr, "                print the work of the search in "
+			"each island to the standard error\n");
+	fprintf(stderr, "  --perf-counters\n");
+	fprintf(stderr, "                print the hardware counters of each "
+			"phase to the standard error\n");
+}
+
+/** Reads a positive number given as the value of the option of argv[*i]. */
+bool parse_number(int argc, char *argv[], int *i, long long *number) {
+	char *end;
+	if (*i + 1 >= argc) {
+		fprintf(stderr, "Missing value of option: %s\n", argv[*i]);
+		return false;
+	}
+	(*i)++;
+	*number = strtoll(argv[*i], &end, 10);
+	if (*end != '\0' || end == argv[*i] || *number < 0) {
+		fprintf(stderr, "Invalid value of option %s: %s\n",
+				argv[*i - 1], argv[*i]);
 		return false;
 	}
 	return true;
 }
 
-int main(void) {
-	hisland islands[MAX_ISLANDS];
-	hconnection connections[MAX_CONNECTIONS];
-	hcrosselem crosselems[MAX_CROSSELEMS];
-	bool visitedmatrix[MAX_VISITED_SIZE];
+/** Reads the path given as the value of the option of argv[*i]. */
+bool parse_path(int argc, char *argv[], int *i, char **path) {
+	if (*i + 1 >= argc) {
+		fprintf(stderr, "Missing value of option: %s\n", argv[*i]);
+		return false;
+	}
+	*path = argv[++(*i)];
+	return true;
+}
+
+/** Returns true if the options run another mode than the search of one puzzle
+ * read from the standard input, so the options of that search are ignored. */
+bool other_mode(hoptions *options) {
+	return options->batch || options->interleave || options->pipeline
+			|| options->lanes || options->stream || options->diagram
+			|| options->estimate || options->edits != NULL
+			|| options->emit_jobs != NULL
+			|| options->run_job != NULL
+			|| options->merge_paths != NULL;
+}
+
+bool parse_options(int argc, char *argv[], hoptions *options) {
+	int i;
+	long long number;
+	options->estimate = false;
+	options->probes = DEFAULT_PROBES;
+	options->seed = DEFAULT_SEED;
+	options->batch = false;
+	options->interleave = false;
+	options->pipeline = false;
+	options->lanes = false;
+	options->count = false;
+	options->limit = 0;
+	options->find_one = false;
+	options->restart_nodes = 0;
+	options->local_steps = DEFAULT_LOCAL_STEPS;
+	options->keep_phases = false;
+	options->stream = false;
+	options->sparse = false;
+	options->band_rows = DEFAULT_BAND_ROWS;
+	options->format = FORMAT_BOARD;
+	options->engine = ENGINE_ISLANDS;
+	options->async_output = false;
+	options->diagram = false;
+	options->marginals = false;
+	options->samples = 0;
+	options->enumerate = 0;
+	options->split = -1;
+	options->emit_jobs = NULL;
+	options->run_job = NULL;
+	options->edits = NULL;
+	options->trace = NULL;
+	options->tracer = NULL;
+	options->merge_paths = NULL;
+	options->num_merge_paths = 0;
+	options->flow_check = 0;
+	options->implications = 0;
+	options->cut_edges = 0;
+	options->lp = 0;
+	options->stats = false;
+	options->profile_islands = false;
+	options->perf_counters = false;
+	options->latency = false;
+	options->latency_interval = 0;
+	options->threads = count_processors();
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--estimate") == 0) {
+			options->estimate = true;
+		} else if (strcmp(argv[i], "--batch") == 0) {
+			options->batch = true;
+		} else if (strcmp(argv[i], "--interleave") == 0) {
+			options->interleave = true;
+		} else if (strcmp(argv[i], "--pipeline") == 0) {
+			options->pipeline = true;
+		} else if (strcmp(argv[i], "--lanes") == 0) {
+			options->lanes = true;
+		} else if (strcmp(argv[i], "--count") == 0) {
+			options->count = true;
+		} else if (strcmp(argv[i], "--async-output") == 0) {
+			options->async_output = true;
+		} else if (strcmp(argv[i], "--format=board") == 0) {
+			options->format = FORMAT_BOARD;
+		} else if (strcmp(argv[i], "--format=delta") == 0) {
+			options->format = FORMAT_DELTA;
+		} else if (strcmp(argv[i], "--engine=islands") == 0) {
+			options->engine = ENGINE_ISLANDS;
+		} else if (strcmp(argv[i], "--engine=topology") == 0) {
+			options->engine = ENGINE_TOPOLOGY;
+		} else if (strcmp(argv[i], "--engine=local") == 0) {
+			options->engine = ENGINE_LOCAL;
+		} else if (strcmp(argv[i], "--engine=middle") == 0) {
+			options->engine = ENGINE_MIDDLE;
+		} else if (strcmp(argv[i], "--stream") == 0) {
+			options->stream = true;
+		} else if (strcmp(argv[i], "--sparse") == 0) {
+			options->sparse = true;
+		} else if (strcmp(argv[i], "--band-rows") == 0) {
+			if (! parse_number(argc, argv, &i, &number)) {
+				return false;
+			}
+			if (number < 1 || number
+					> INT_MAX / (2 * STREAM_DEFER_BANDS)) {
+				fprintf(stderr, "Invalid band rows: %lld\n",
+						number);
+				return false;
+			}
+			options->band_rows = (int) number;
+		} else if (strcmp(argv[i], "--local-steps") == 0) {
+			if (! parse_number(argc, argv, &i,
+					&options->local_steps)) {
+				return false;
+			}
+		} else if (strcmp(argv[i], "--limit") == 0) {
+			if (! parse_number(argc, argv, &i, &options->limit)) {
+				return false;
+			}
+		} else if (strcmp(argv[i], "--find-one") == 0) {
+			options->find_one = true;
+		} else if (strcmp(argv[i], "--keep-phases") == 0) {
+			options->keep_phases = true;
+		} else if (strcmp(argv[i], "--restart-nodes") == 0) {
+			if (! parse_number(argc, argv, &i, &number)) {
+				return false;
+			}
+			if (number < 1 || number > INT_MAX) {
+				fprintf(stderr, "Invalid restart nodes: %lld\n",
+						number);
+				return false;
+			}
+			options->restart_nodes = number;
+		} else if (strcmp(argv[i], "--diagram") == 0) {
+			options->diagram = true;
+		} else if (strcmp(argv[i], "--marginals") == 0) {
+			options->marginals = true;
+		} else if (strcmp(argv[i], "--sample") == 0
+				|| strcmp(argv[i], "--enumerate") == 0) {
+			if (! parse_number(argc, argv, &i, &number)) {
+				return false;
+			}
+			if (number > INT_MAX) {
+				number = INT_MAX;
+			}
+			if (argv[i - 1][2] == 's') {
+				options->samples = (int) number;
+			} else {
+				options->enumerate = (int) number;
+			}
+		} else if (strcmp(argv[i], "--split") == 0) {
+			if (! parse_number(argc, argv, &i, &number)) {
+				return false;
+			}
+			options->split = number > INT_MAX ? INT_MAX : number;
+		} else if (strcmp(argv[i], "--emit-jobs") == 0) {
+			if (! parse_path(argc, argv, &i, &options->emit_jobs)) {
+				return false;
+			}
+		} else if (strcmp(argv[i], "--run-job") == 0) {
+			if (! parse_path(argc, argv, &i, &options->run_job)) {
+				return false;
+			}
+		} else if (strcmp(argv[i], "--edits") == 0) {
+			if (! parse_path(argc, argv, &i, &options->edits)) {
+				return false;
+			}
+		} else if (strcmp(argv[i], "--trace") == 0) {
+			if (! parse_path(argc, argv, &i, &options->trace)) {
+				return false;
+			}
+		} else if (strcmp(argv[i], "--merge") == 0) {
+			options->merge_paths = argv + i + 1;
+			options->num_merge_paths = argc - i - 1;
+			break;
+		} else if (strcmp(argv[i], "--threads") == 0) {
+			if (! parse_number(argc, argv, &i, &number)) {
+				return false;
+			}
+			if (number < 1 || number > INT_MAX) {
+				fprintf(stderr, "Invalid threads: %lld\n",
+						number);
+				return false;
+			}
+			options->threads = (int) number;
+		} else if (strcmp(argv[i], "--probes") == 0) {
+			if (! parse_number(argc, argv, &i, &number)) {
+				return false;
+			}
+			if (number < 1 || number > INT_MAX) {
+				fprintf(stderr, "Invalid probes: %lld\n",
+						number);
+				return false;
+			}
+			options->probes = (int) number;
+		} else if (strcmp(argv[i], "--flow-check") == 0
+				|| strcmp(argv[i], "--implications") == 0
+				|| strcmp(argv[i], "--cut-edges") == 0
+				|| strcmp(argv[i], "--lp") == 0) {
+			if (! parse_number(argc, argv, &i, &number)) {
+				return false;
+			}
+			if (number > INT_MAX) {
+				number = INT_MAX;
+			}
+			if (argv[i - 1][2] == 'f') {
+				options->flow_check = (int) number;
+			} else if (argv[i - 1][2] == 'i') {
+				options->implications = (int) number;
+			} else if (argv[i - 1][2] == 'c') {
+				options->cut_edges = (int) number;
+			} else {
+				options->lp = (int) number;
+			}
+		} else if (strcmp(argv[i], "--stats") == 0) {
+			options->stats = true;
+		} else if (strcmp(argv[i], "--profile-islands") == 0) {
+			options->profile_islands = true;
+		} else if (strcmp(argv[i], "--perf-counters") == 0) {
+			options->perf_counters = true;
+		} else if (strcmp(argv[i], "--latency") == 0) {
+			options->latency = true;
+		} else if (strcmp(argv[i], "--latency-interval") == 0) {
+			if (! parse_number(argc, argv, &i,
+					&options->latency_interval)) {
+				return false;
+			}
+			options->latency = true;
+		} else if (strcmp(argv[i], "--seed") == 0) {
+			if (! parse_number(argc, argv, &i, &number)) {
+				return false;
+			}
+			options->seed = (unsigned long long) number;
+		} else {
+			fprintf(stderr, "Unknown option: %s\n", argv[i]);
+			return false;
+		}
+	}
+	if (options->batch + options->interleave + options->pipeline
+			+ options->lanes + options->stream > 1) {
+		fprintf(stderr, "Options --batch, --interleave, --pipeline, "
+				"--lanes and --stream exclude each other\n");
+		return false;
+	}
+	if ((options->split > -1) != (options->emit_jobs != NULL)) {
+		fprintf(stderr, "Options --split and --emit-jobs "
+				"go together\n");
+		return false;
+	}
+	if (options->trace != NULL && (options->lanes || options->interleave
+			|| options->stream || options->engine == ENGINE_LOCAL
+			|| options->merge_paths != NULL || options->estimate
+			|| options->diagram || options->emit_jobs != NULL
+			|| options->run_job != NULL)) {
+		fprintf(stderr, "Option --trace only traces one puzzle, "
+				"--batch or --pipeline\n");
+		return false;
+	}
+	if (options->perf_counters && (options->batch || options->pipeline
+			|| options->lanes || options->interleave
+			|| options->stream || options->engine == ENGINE_LOCAL
+			|| options->async_output || options->merge_paths != NULL
+			|| options->estimate || options->diagram
+			|| options->emit_jobs != NULL
+			|| options->run_job != NULL)) {
+		fprintf(stderr, "Option --perf-counters only measures "
+				"one puzzle solved in one thread\n");
+		return false;
+	}
+	if (options->profile_islands && (options->batch || options->pipeline
+			|| options->lanes || options->interleave
+			|| options->stream || options->engine != ENGINE_ISLANDS
+			|| options->merge_paths != NULL || options->estimate
+			|| options->diagram || options->emit_jobs != NULL
+			|| options->run_job != NULL
+			|| options->edits != NULL)) {
+		fprintf(stderr, "Option --profile-islands only profiles "
+				"one puzzle solved by the islands engine\n");
+		return false;
+	}
+	if (options->latency && ! options->batch) {
+		fprintf(stderr, "Option --latency needs --batch\n");
+		return false;
+	}
+	if (options->sparse && (options->batch || options->pipeline
+			|| options->lanes || options->interleave
+			|| options->stream || options->engine == ENGINE_LOCAL
+			|| options->merge_paths != NULL
+			|| options->run_job != NULL)) {
+		fprintf(stderr, "Option --sparse only reads one puzzle, "
+				"without --stream or --engine=local\n");
+		return false;
+	}
+	if (options->limit > 0 && (other_mode(options)
+			|| options->async_output)) {
+		fprintf(stderr, "Option --limit only stops the search of "
+				"one puzzle, without --async-output\n");
+		return false;
+	}
+	if (options->edits != NULL && (options->flow_check > 0
+			|| options->implications > 0 || options->cut_edges > 0
+			|| options->lp > 0)) {
+		fprintf(stderr, "Option --edits does not prune with "
+				"--flow-check, --implications, --cut-edges "
+				"or --lp\n");
+		return false;
+	}
+	if (options->find_one && (other_mode(options) || options->limit > 0
+			|| options->async_output)) {
+		fprintf(stderr, "Option --find-one only searches one puzzle, "
+				"without --limit or --async-output\n");
+		return false;
+	}
+	if (options->keep_phases && ! options->find_one) {
+		fprintf(stderr, "Option --keep-phases needs --find-one\n");
+		return false;
+	}
+	if (options->restart_nodes > 0 && ! options->find_one
+			&& options->edits == NULL) {
+		fprintf(stderr, "Option --restart-nodes needs --find-one "
+				"or --edits\n");
+		return false;
+	}
+	if (options->restart_nodes == 0) {
+		options->restart_nodes = DEFAULT_RESTART_NODES;
+	}
+	if (options->engine != ENGINE_ISLANDS && other_mode(options)) {
+		fprintf(stderr, "Option --engine only chooses the search of "
+				"one puzzle\n");
+		return false;
+	}
+	if (options->engine != ENGINE_ISLANDS && (options->limit > 0
+			|| options->async_output || options->find_one)) {
+		fprintf(stderr, "Options --limit, --async-output and "
+				"--find-one use the islands engine\n");
+		return false;
+	}
+	return true;
+}
+
+/** Writes the trace of the solving if it was requested. */
+bool finish_trace(hoptions *options) {
+	return options->tracer == NULL
+			|| write_tracer(options->tracer, options->trace);
+}
+
+int main(int argc, char *argv[]) {
+	hstorage storage;
 	hboard board;
-	init_board(&board, islands, MAX_ISLANDS, connections, MAX_CONNECTIONS,
-		crosselems, MAX_CROSSELEMS, visitedmatrix, MAX_VISITED_SIZE);
-	if (! read_islands(&board)) {
+	hoptions options;
+	bool solved;
+	long long start;
+	if (! parse_options(argc, argv, &options)) {
+		print_usage(argv[0]);
+		exit(-1);
+	}
+	if (options.trace != NULL && (options.tracer = new_tracer()) == NULL) {
+		exit(-1);
+	}
+	if (options.merge_paths != NULL) {
+		if (! merge_jobs(options.merge_paths,
+				options.num_merge_paths)) {
+			exit(-1);
+		}
+		return 0;
+	}
+	if (options.lanes) {
+		if (! solve_lanes(&options)) {
+			exit(-1);
+		}
+		return 0;
+	}
+	if (options.pipeline) {
+		if (! solve_pipeline(&options) || ! finish_trace(&options)) {
+			exit(-1);
+		}
+		return 0;
+	}
+	if (options.interleave) {
+		if (! solve_interleaved(&options)) {
+			exit(-1);
+		}
+		return 0;
+	}
+	if (options.batch) {
+		if (! solve_batch(&options) || ! finish_trace(&options)) {
+			exit(-1);
+		}
+		return 0;
+	}
+	if (options.stream) {
+		if (! solve_stream(options.count, options.band_rows)) {
+			exit(-1);
+		}
+		return 0;
+	}
+	if (options.engine == ENGINE_LOCAL) {
+		if (! solve_local(&options)) {
+			exit(-1);
+		}
+		return 0;
+	}
+	init_board_storage(&board, &storage);
+	board.count_only = options.count;
+	if (options.tracer != NULL && (board.trace = add_trace(options.tracer,
+			"main")) == NULL) {
+		exit(-1);
+	}
+	if (options.perf_counters && (board.counters = new_counters())
+			== NULL) {
+		exit(-1);
+	}
+	if (options.run_job != NULL) {
+		if (! run_job(&board, options.run_job, options.format)) {
+			exit(-1);
+		}
+		return 0;
+	}
+	start = monotonic_nanos();
+	if (board.counters != NULL) {
+		enter_phase(board.counters, PHASE_READ);
+	}
+	if (options.sparse ? ! read_sparse_islands(&board)
+			: ! read_islands(&board)) {
 		exit(-1);
 	}
-	print_board(&board);
-	if (board.num_islands) {
-		if (! valid_visited_matrix_size(&board)) {
+	if (board.counters != NULL) {
+		leave_phase(board.counters);
+	}
+	if (board.trace != NULL) {
+		trace_span(board.trace, "read", start, -1, 1);
+	}
+	set_output_format(&board, options.format);
+	if (options.diagram) {
+		hrandom rnd;
+		init_random(&rnd, options.seed);
+		if (! solve_diagram(&board, &rnd, options.samples,
+				options.marginals, options.enumerate)) {
+			exit(-1);
+		}
+		return 0;
+	}
+	if (options.emit_jobs != NULL) {
+		if (! emit_jobs(&board, options.split, options.emit_jobs)) {
+			exit(-1);
+		}
+		return 0;
+	}
+	if (options.edits != NULL) {
+		start = monotonic_nanos();
+		if (board.counters != NULL) {
+			enter_phase(board.counters, PHASE_SEARCH);
+		}
+		solved = solve_edits(&board, options.edits, options.seed,
+				options.restart_nodes);
+		if (board.counters != NULL) {
+			leave_phase(board.counters);
+		}
+		if (board.trace != NULL) {
+			trace_span(board.trace, "solve", start, -1, 1);
+		}
+		if (! finish_trace(&options)) {
+			solved = false;
+		}
+		if (options.stats) {
+			print_stats(&board);
+		}
+		if (board.counters != NULL) {
+			print_counters(board.counters, stderr);
+			free_counters(board.counters);
+		}
+		if (options.sparse) {
+			free_board_arrays(&board);
+		}
+		if (! solved) {
 			exit(-1);
 		}
-		find_solutions_from_island(&board, 0);
+		return 0;
+	}
+	if (options.flow_check > 0 && (board.flow = new_flow(&board,
+			options.flow_check)) == NULL) {
+		exit(-1);
+	}
+	if (options.implications > 0 && (board.implications =
+			new_implications(&board, options.implications))
+			== NULL) {
+		exit(-1);
+	}
+	if (options.cut_edges > 0 && (board.cuts = new_cuts(&board,
+			options.cut_edges)) == NULL) {
+		exit(-1);
+	}
+	if (options.lp > 0 && (board.lp = new_lp(&board, options.lp))
+			== NULL) {
+		exit(-1);
+	}
+	if (options.estimate) {
+		hrandom rnd;
+		hestimate estimate;
+		init_random(&rnd, options.seed);
+		estimate_search_tree(&board, &rnd, options.probes, &estimate);
+		print_estimate(&estimate);
+		return 0;
+	}
+	if (options.profile_islands && (board.profile = new_profile(&board))
+			== NULL) {
+		exit(-1);
+	}
+	start = monotonic_nanos();
+	if (board.counters != NULL) {
+		enter_phase(board.counters, PHASE_SEARCH);
+	}
+	if (options.find_one) {
+		solved = solve_board_find_one(&board, options.seed,
+				options.restart_nodes, options.keep_phases);
+	} else if (options.engine == ENGINE_TOPOLOGY) {
+		solved = solve_board_topology(&board);
+	} else if (options.engine == ENGINE_MIDDLE) {
+		solved = solve_board_middle(&board);
+	} else if (options.limit > 0) {
+		solved = solve_board_up_to(&board, &storage, options.limit);
+	} else if (options.async_output) {
+		solved = solve_board_async(&board);
+	} else {
+		solved = solve_board(&board);
+	}
+	if (board.counters != NULL) {
+		leave_phase(board.counters);
+	}
+	if (board.trace != NULL) {
+		trace_span(board.trace, "solve", start, -1, 1);
+	}
+	if (! finish_trace(&options)) {
+		solved = false;
+	}
+	if (options.stats) {
+		print_stats(&board);
+	}
+	if (board.profile != NULL) {
+		print_profile(&board, stderr);
+		free_profile(board.profile);
+	}
+	if (board.counters != NULL) {
+		print_counters(board.counters, stderr);
+		free_counters(board.counters);
+	}
+	if (board.flow != NULL) {
+		free_flow(board.flow);
+	}
+	if (board.implications != NULL) {
+		free_implications(board.implications);
+	}
+	if (board.cuts != NULL) {
+		free_cuts(board.cuts);
+	}
+	if (board.lp != NULL) {
+		free_lp(board.lp);
+	}
+	if (options.sparse) {
+		free_board_arrays(&board);
+	}
+	if (! solved) {
+		exit(-1);
 	}
 	return 0;
 }